@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2019 Aapo Vienamo
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Compares loading a level by pushing every sprite through
+ * glsprite_draw_buffer_push_grid against mapping a snapshot of it.
+ *
+ * Usage: snapshot-bench [num_sprites] [snapshot_path]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "glsprite.h"
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Reads one byte of every page of the array so that each page is faulted in. */
+static unsigned touch(const void *arr, size_t len)
+{
+    const unsigned char *p = arr;
+    unsigned sum = 0;
+    size_t i;
+
+    for (i = 0; i < len; i += 4096)
+        sum += p[i];
+
+    return len ? sum + p[len - 1] : sum;
+}
+
+/* Touches every array the renderer uploads. */
+static unsigned touch_buffer(const struct glsprite_draw_buffer *buf)
+{
+    size_t n = buf->num_sprites;
+    unsigned sum = 0;
+
+    sum += touch(buf->sheet_offsets, n * sizeof(buf->sheet_offsets[0]));
+    sum += touch(buf->sprite_positions, n * sizeof(buf->sprite_positions[0]));
+    sum += touch(buf->sprite_dimensions,
+                 n * sizeof(buf->sprite_dimensions[0]));
+    sum += touch(buf->sprite_origins, n * sizeof(buf->sprite_origins[0]));
+    sum += touch(buf->sprite_angles, n * sizeof(buf->sprite_angles[0]));
+
+    if (buf->sprite_slices) {
+        sum += touch(buf->sheet_dimensions,
+                     n * sizeof(buf->sheet_dimensions[0]));
+        sum += touch(buf->sprite_slices, n * sizeof(buf->sprite_slices[0]));
+        sum += touch(buf->sprite_repeats, n * sizeof(buf->sprite_repeats[0]));
+    }
+
+    return sum;
+}
+
+static void push_level(struct glsprite_draw_buffer *buf,
+                       const struct glsprite_grid *grid, size_t num_sprites)
+{
+    size_t i;
+
+    for (i = 0; i < num_sprites; ++i)
+        glsprite_draw_buffer_push_grid(buf, grid,
+                                       vec2i_init(i % 30, (i / 30) % 30),
+                                       vec2f_init(i % 1024, i / 1024),
+                                       vec2f_init(10, 10), 0.0f);
+}
+
+int main(int argc, char **argv)
+{
+    size_t num_sprites = argc > 1 ? strtoul(argv[1], NULL, 0) : 500000;
+    const char *path = argc > 2 ? argv[2] : "snapshot-bench.bin";
+    struct glsprite_draw_buffer buf;
+    struct glsprite_snapshot snap;
+    struct glsprite_sheet sheet;
+    struct glsprite_grid grid;
+    double t0, t_push, t_map;
+    unsigned sum;
+
+    glsprite_sheet_init(&sheet, 0, 692, 692);
+    glsprite_grid_init(&grid, 21, 21, 2);
+
+    glsprite_draw_buffer_init(&buf, &sheet);
+    push_level(&buf, &grid, num_sprites);
+    if (glsprite_snapshot_write(path, &buf, "spritesheet.png")) {
+        fprintf(stderr, "Writing snapshot \"%s\" failed\n", path);
+        return EXIT_FAILURE;
+    }
+    glsprite_draw_buffer_destroy(&buf);
+
+    t0 = now();
+    glsprite_draw_buffer_init(&buf, &sheet);
+    push_level(&buf, &grid, num_sprites);
+    t_push = now() - t0;
+    glsprite_draw_buffer_destroy(&buf);
+
+    t0 = now();
+    if (glsprite_snapshot_open(&snap, path) ||
+        glsprite_draw_buffer_init_snapshot(&buf, &sheet, &snap)) {
+        fprintf(stderr, "Loading snapshot \"%s\" failed\n", path);
+        return EXIT_FAILURE;
+    }
+    t_map = now() - t0;
+
+    /* The mapping is faulted in lazily, so that has to be timed too. */
+    t0 = now();
+    sum = touch_buffer(&buf);
+    t_map += now() - t0;
+
+    printf("sprites:        %zu\n", num_sprites);
+    printf("push_grid:      %.3f ms\n", t_push * 1e3);
+    printf("snapshot mmap:  %.3f ms (checksum %u)\n", t_map * 1e3, sum);
+
+    glsprite_draw_buffer_destroy(&buf);
+    glsprite_snapshot_close(&snap);
+    remove(path);
+
+    return EXIT_SUCCESS;
+}
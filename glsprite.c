@@ -4,6 +4,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #define GL_GLEXT_PROTOTYPES
 #if defined(__APPLE__)
@@ -32,13 +33,177 @@ enum {
     VA_IDX_SPRITE_ROT,
     VA_IDX_SHEET_OFFSET,
     VA_IDX_SPRITE_ORIGIN,
+    VA_IDX_SHEET_SIZE,
+    VA_IDX_SPRITE_SLICE,
+    VA_IDX_SPRITE_REPEAT,
 };
 
-int glsprite_renderer_init(struct glsprite_renderer *r, GLuint prog_id,
+void glsprite_render_state_use_program(struct glsprite_render_state *state,
+                                       GLuint prog_id)
+{
+    if (state->prog_id == prog_id) {
+        ++state->num_calls_avoided;
+        return;
+    }
+
+    glUseProgram(prog_id);
+    state->prog_id = prog_id;
+}
+
+void
+glsprite_render_state_bind_vertex_array(struct glsprite_render_state *state,
+                                        GLuint vao_id)
+{
+    if (state->vao_id == vao_id) {
+        ++state->num_calls_avoided;
+        return;
+    }
+
+    glBindVertexArray(vao_id);
+    state->vao_id = vao_id;
+}
+
+void
+glsprite_render_state_bind_array_buffer(struct glsprite_render_state *state,
+                                        GLuint vbo_id)
+{
+    if (state->array_buffer_id == vbo_id) {
+        ++state->num_calls_avoided;
+        return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_id);
+    state->array_buffer_id = vbo_id;
+}
+
+void glsprite_render_state_bind_texture(struct glsprite_render_state *state,
+                                        GLuint texture_id)
+{
+    if (state->texture_id == texture_id) {
+        ++state->num_calls_avoided;
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    state->texture_id = texture_id;
+}
+
+/*
+ * Uniforms are per program state, so the cached values only hold for the
+ * program that they were set on.
+ */
+void glsprite_render_state_set_sheet_size(struct glsprite_render_state *state,
+                                          GLuint prog_id, GLint loc,
+                                          unsigned width, unsigned height)
+{
+    if (loc < 0)
+        return;
+
+    if (state->sheet_size_prog_id == prog_id &&
+        state->sheet_width == width && state->sheet_height == height) {
+        ++state->num_calls_avoided;
+        return;
+    }
+
+    glUniform2f(loc, width, height);
+    state->sheet_size_prog_id = prog_id;
+    state->sheet_width = width;
+    state->sheet_height = height;
+}
+
+void glsprite_render_state_set_use_regions(struct glsprite_render_state *state,
+                                           GLuint prog_id, GLint loc,
+                                           int use_regions)
+{
+    if (loc < 0)
+        return;
+
+    if (state->use_regions_prog_id == prog_id &&
+        state->use_regions == use_regions) {
+        ++state->num_calls_avoided;
+        return;
+    }
+
+    glUniform1i(loc, use_regions);
+    state->use_regions_prog_id = prog_id;
+    state->use_regions = use_regions;
+}
+
+void glsprite_render_state_set_time(struct glsprite_render_state *state,
+                                    GLuint prog_id, GLint loc, float time)
+{
+    if (loc < 0)
+        return;
+
+    if (state->time_prog_id == prog_id && state->time == time) {
+        ++state->num_calls_avoided;
+        return;
+    }
+
+    glUniform1f(loc, time);
+    state->time_prog_id = prog_id;
+    state->time = time;
+}
+
+void
+glsprite_render_state_forget_vertex_array(struct glsprite_render_state *state,
+                                          GLuint vao_id)
+{
+    /*
+     * Deleting unbinds the objects and their names may be handed out again,
+     * so they must not be left in the shared state.
+     */
+    if (state->vao_id == vao_id)
+        state->vao_id = 0;
+    state->array_buffer_id = 0;
+}
+
+/*
+ * Expects the renderer vertex array to be bound. Enabled arrays are vertex
+ * array state, so unlike the rest this is tracked in the renderer.
+ */
+static void enable_regions(struct glsprite_renderer *r, int enable)
+{
+    if (r->regions_enabled == enable)
+        return;
+
+    if (enable) {
+        glEnableVertexAttribArray(VA_IDX_SHEET_SIZE);
+        glEnableVertexAttribArray(VA_IDX_SPRITE_SLICE);
+        glEnableVertexAttribArray(VA_IDX_SPRITE_REPEAT);
+    } else {
+        glDisableVertexAttribArray(VA_IDX_SHEET_SIZE);
+        glDisableVertexAttribArray(VA_IDX_SPRITE_SLICE);
+        glDisableVertexAttribArray(VA_IDX_SPRITE_REPEAT);
+    }
+
+    r->regions_enabled = enable;
+}
+
+void glsprite_render_state_invalidate(struct glsprite_render_state *state)
+{
+    state->prog_id = 0;
+    state->vao_id = 0;
+    state->array_buffer_id = 0;
+    state->texture_id = 0;
+    state->sheet_size_prog_id = 0;
+    state->use_regions_prog_id = 0;
+    state->time_prog_id = 0;
+}
+
+void glsprite_render_state_init(struct glsprite_render_state *state)
+{
+    state->num_calls_avoided = 0;
+    glsprite_render_state_invalidate(state);
+}
+
+int glsprite_renderer_init(struct glsprite_renderer *r,
+                           struct glsprite_render_state *state, GLuint prog_id,
                            unsigned screen_w, unsigned screen_h)
 {
     r->prog_id = prog_id;
-    glUseProgram(prog_id);
+    r->state = state;
+    glsprite_render_state_use_program(state, prog_id);
 
     r->screen_size_uniform_loc = glGetUniformLocation(prog_id, "screen_size");
     if (r->screen_size_uniform_loc < 0)
@@ -48,43 +213,60 @@ int glsprite_renderer_init(struct glsprite_renderer *r, GLuint prog_id,
     if (r->sheet_size_uniform_loc < 0)
         return -1;
 
+    r->use_regions_uniform_loc = glGetUniformLocation(prog_id, "use_regions");
+
     glUniform2f(r->screen_size_uniform_loc, screen_w, screen_h);
 
     glGenVertexArrays(1, &r->vao_id);
-    glBindVertexArray(r->vao_id);
+    glsprite_render_state_bind_vertex_array(r->state, r->vao_id);
 
     glGenBuffers(1, &r->quad_verts_vbo_id);
-    glBindBuffer(GL_ARRAY_BUFFER, r->quad_verts_vbo_id);
+    glsprite_render_state_bind_array_buffer(r->state, r->quad_verts_vbo_id);
     glBufferData(GL_ARRAY_BUFFER, sizeof(quad_verts), quad_verts,
                  GL_STATIC_DRAW);
     glVertexAttribPointer(VA_IDX_QUAD_VERT, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
     glGenBuffers(1, &r->sprite_pos_vbo_id);
-    glBindBuffer(GL_ARRAY_BUFFER, r->sprite_pos_vbo_id);
+    glsprite_render_state_bind_array_buffer(r->state, r->sprite_pos_vbo_id);
     glVertexAttribPointer(VA_IDX_SPRITE_POS, 2, GL_FLOAT, GL_FALSE, 0, 0);
 
     glGenBuffers(1, &r->sprite_size_vbo_id);
-    glBindBuffer(GL_ARRAY_BUFFER, r->sprite_size_vbo_id);
+    glsprite_render_state_bind_array_buffer(r->state, r->sprite_size_vbo_id);
     glVertexAttribPointer(VA_IDX_SPRITE_SIZE, 2, GL_FLOAT, GL_FALSE, 0, 0);
 
     glGenBuffers(1, &r->sprite_rot_vbo_id);
-    glBindBuffer(GL_ARRAY_BUFFER, r->sprite_rot_vbo_id);
+    glsprite_render_state_bind_array_buffer(r->state, r->sprite_rot_vbo_id);
     glVertexAttribPointer(VA_IDX_SPRITE_ROT, 1, GL_FLOAT, GL_FALSE, 0, 0);
 
     glGenBuffers(1, &r->sheet_offset_vbo_id);
-    glBindBuffer(GL_ARRAY_BUFFER, r->sheet_offset_vbo_id);
+    glsprite_render_state_bind_array_buffer(r->state, r->sheet_offset_vbo_id);
     glVertexAttribPointer(VA_IDX_SHEET_OFFSET, 2, GL_FLOAT, GL_FALSE, 0, 0);
 
     glGenBuffers(1, &r->sprite_origin_vbo_id);
-    glBindBuffer(GL_ARRAY_BUFFER, r->sprite_origin_vbo_id);
+    glsprite_render_state_bind_array_buffer(r->state, r->sprite_origin_vbo_id);
     glVertexAttribPointer(VA_IDX_SPRITE_ORIGIN, 2, GL_FLOAT, GL_FALSE, 0, 0);
 
+    glGenBuffers(1, &r->sheet_size_vbo_id);
+    glsprite_render_state_bind_array_buffer(r->state, r->sheet_size_vbo_id);
+    glVertexAttribPointer(VA_IDX_SHEET_SIZE, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+    glGenBuffers(1, &r->sprite_slice_vbo_id);
+    glsprite_render_state_bind_array_buffer(r->state, r->sprite_slice_vbo_id);
+    glVertexAttribPointer(VA_IDX_SPRITE_SLICE, 4, GL_FLOAT, GL_FALSE, 0, 0);
+
+    glGenBuffers(1, &r->sprite_repeat_vbo_id);
+    glsprite_render_state_bind_array_buffer(r->state, r->sprite_repeat_vbo_id);
+    glVertexAttribPointer(VA_IDX_SPRITE_REPEAT, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
     glVertexAttribDivisor(VA_IDX_QUAD_VERT, 0);
     glVertexAttribDivisor(VA_IDX_SPRITE_POS, 1);
     glVertexAttribDivisor(VA_IDX_SPRITE_SIZE, 1);
     glVertexAttribDivisor(VA_IDX_SPRITE_ROT, 1);
     glVertexAttribDivisor(VA_IDX_SHEET_OFFSET, 1);
     glVertexAttribDivisor(VA_IDX_SPRITE_ORIGIN, 1);
+    glVertexAttribDivisor(VA_IDX_SHEET_SIZE, 1);
+    glVertexAttribDivisor(VA_IDX_SPRITE_SLICE, 1);
+    glVertexAttribDivisor(VA_IDX_SPRITE_REPEAT, 1);
 
     glEnableVertexAttribArray(VA_IDX_QUAD_VERT);
     glEnableVertexAttribArray(VA_IDX_SPRITE_POS);
@@ -92,6 +274,7 @@ int glsprite_renderer_init(struct glsprite_renderer *r, GLuint prog_id,
     glEnableVertexAttribArray(VA_IDX_SPRITE_ROT);
     glEnableVertexAttribArray(VA_IDX_SHEET_OFFSET);
     glEnableVertexAttribArray(VA_IDX_SPRITE_ORIGIN);
+    r->regions_enabled = 0;
 
     return 0;
 }
@@ -102,6 +285,19 @@ void glsprite_sheet_init(struct glsprite_sheet *sheet, GLuint texture_id,
     sheet->texture_id = texture_id;
     sheet->width = width;
     sheet->height = height;
+    sheet->vram_bytes = 0;
+}
+
+void glsprite_sheet_destroy(struct glsprite_sheet *sheet,
+                            struct glsprite_render_state *state)
+{
+    /* Deleting unbinds the texture and its name may be handed out again. */
+    if (state && state->texture_id == sheet->texture_id)
+        state->texture_id = 0;
+
+    glDeleteTextures(1, &sheet->texture_id);
+    sheet->texture_id = 0;
+    sheet->vram_bytes = 0;
 }
 
 void glsprite_grid_init(struct glsprite_grid *grid, unsigned sprite_width,
@@ -123,10 +319,34 @@ void glsprite_draw_buffer_init(struct glsprite_draw_buffer *buf,
     buf->sprite_dimensions = NULL;
     buf->sprite_origins = NULL;
     buf->sprite_angles = NULL;
+    buf->sheet_dimensions = NULL;
+    buf->sprite_slices = NULL;
+    buf->sprite_repeats = NULL;
+    buf->borrowed = 0;
+}
+
+/*
+ * Borrowed arrays live in a snapshot mapping and can't be passed to realloc,
+ * so they get copied to the heap the first time the buffer needs to grow.
+ */
+static void *grow_array(void *arr, size_t elem_sz, size_t len, size_t n,
+                        int borrowed)
+{
+    void *new_arr;
+
+    if (!borrowed)
+        return realloc(arr, elem_sz * n);
+
+    new_arr = malloc(elem_sz * n);
+    if (new_arr)
+        memcpy(new_arr, arr, elem_sz * len);
+
+    return new_arr;
 }
 
 void glsprite_draw_buffer_grow(struct glsprite_draw_buffer *buf)
 {
+    size_t len = buf->num_sprites;
     size_t n = buf->num_allocd;
 
     if (n == 0)
@@ -134,20 +354,63 @@ void glsprite_draw_buffer_grow(struct glsprite_draw_buffer *buf)
 
     n = buf->num_allocd * 2;
 
-    buf->sheet_offsets = realloc(buf->sheet_offsets,
-                                 sizeof(buf->sheet_offsets[0]) * n);
-    buf->sprite_positions = realloc(buf->sprite_positions,
-                                    sizeof(buf->sprite_positions[0]) * n);
-    buf->sprite_dimensions = realloc(buf->sprite_dimensions,
-                                     sizeof(buf->sprite_dimensions[0]) * n);
-    buf->sprite_origins = realloc(buf->sprite_origins,
-                                  sizeof(buf->sprite_origins[0]) * n);
-    buf->sprite_angles = realloc(buf->sprite_angles,
-                                 sizeof(buf->sprite_angles[0]) * n);
-
+    buf->sheet_offsets = grow_array(buf->sheet_offsets,
+                                   sizeof(buf->sheet_offsets[0]),
+                                   len, n, buf->borrowed);
+    buf->sprite_positions = grow_array(buf->sprite_positions,
+                                      sizeof(buf->sprite_positions[0]),
+                                      len, n, buf->borrowed);
+    buf->sprite_dimensions = grow_array(buf->sprite_dimensions,
+                                       sizeof(buf->sprite_dimensions[0]),
+                                       len, n, buf->borrowed);
+    buf->sprite_origins = grow_array(buf->sprite_origins,
+                                    sizeof(buf->sprite_origins[0]),
+                                    len, n, buf->borrowed);
+    buf->sprite_angles = grow_array(buf->sprite_angles,
+                                   sizeof(buf->sprite_angles[0]),
+                                   len, n, buf->borrowed);
+
+    if (buf->sprite_slices) {
+        buf->sheet_dimensions = grow_array(buf->sheet_dimensions,
+                                          sizeof(buf->sheet_dimensions[0]),
+                                          len, n, buf->borrowed);
+        buf->sprite_slices = grow_array(buf->sprite_slices,
+                                       sizeof(buf->sprite_slices[0]),
+                                       len, n, buf->borrowed);
+        buf->sprite_repeats = grow_array(buf->sprite_repeats,
+                                        sizeof(buf->sprite_repeats[0]),
+                                        len, n, buf->borrowed);
+    }
+
+    buf->borrowed = 0;
     buf->num_allocd = n;
 }
 
+void glsprite_draw_buffer_add_regions(struct glsprite_draw_buffer *buf)
+{
+    static const struct glsprite_slice no_slice = { 0.0f, 0.0f, 0.0f, 0.0f };
+    size_t n;
+    size_t i;
+
+    if (buf->sprite_slices)
+        return;
+
+    /* The arrays are either all borrowed or all on the heap. */
+    if (buf->borrowed || buf->num_allocd == 0)
+        glsprite_draw_buffer_grow(buf);
+
+    n = buf->num_allocd;
+    buf->sheet_dimensions = malloc(n * sizeof(buf->sheet_dimensions[0]));
+    buf->sprite_slices = malloc(n * sizeof(buf->sprite_slices[0]));
+    buf->sprite_repeats = malloc(n * sizeof(buf->sprite_repeats[0]));
+
+    for (i = 0; i < buf->num_sprites; ++i) {
+        buf->sheet_dimensions[i] = buf->sprite_dimensions[i];
+        buf->sprite_slices[i] = no_slice;
+        buf->sprite_repeats[i] = vec2f_init(1.0f, 1.0f);
+    }
+}
+
 void glsprite_draw_buffer_push_grid(struct glsprite_draw_buffer *buf,
                                     const struct glsprite_grid *grid,
                                     struct vec2i sprite_idx,
@@ -162,55 +425,122 @@ void glsprite_draw_buffer_push_grid(struct glsprite_draw_buffer *buf,
                               sprite_orig, sprite_angle);
 }
 
+void glsprite_draw_buffer_push_nine_slice(struct glsprite_draw_buffer *buf,
+                                          struct vec2f sheet_pos,
+                                          struct vec2f sheet_dim,
+                                          const struct glsprite_slice *slice,
+                                          struct vec2f sprite_pos,
+                                          struct vec2f sprite_dim,
+                                          struct vec2f sprite_orig,
+                                          float sprite_angle)
+{
+    glsprite_draw_buffer_push_region(buf, sheet_pos, sheet_dim, slice,
+                                     vec2f_init(1.0f, 1.0f), sprite_pos,
+                                     sprite_dim, sprite_orig, sprite_angle);
+}
+
+void glsprite_draw_buffer_push_tiled(struct glsprite_draw_buffer *buf,
+                                     struct vec2f sheet_pos,
+                                     struct vec2f sheet_dim,
+                                     struct vec2i repeat,
+                                     struct vec2f sprite_pos,
+                                     struct vec2f sprite_orig,
+                                     float sprite_angle)
+{
+    static const struct glsprite_slice no_slice = { 0.0f, 0.0f, 0.0f, 0.0f };
+    struct vec2f rep = vec2f_init(repeat.x, repeat.y);
+
+    glsprite_draw_buffer_push_region(buf, sheet_pos, sheet_dim, &no_slice, rep,
+                                     sprite_pos, vec2f_mul(sheet_dim, rep),
+                                     sprite_orig, sprite_angle);
+}
+
 void glsprite_draw_buffer_destroy(struct glsprite_draw_buffer *buf)
 {
     buf->num_sprites = 0;
     buf->num_allocd = 0;
+
+    if (buf->borrowed) {
+        buf->borrowed = 0;
+        return;
+    }
+
     free(buf->sheet_offsets);
     free(buf->sprite_positions);
     free(buf->sprite_dimensions);
     free(buf->sprite_origins);
     free(buf->sprite_angles);
+    free(buf->sheet_dimensions);
+    free(buf->sprite_slices);
+    free(buf->sprite_repeats);
 }
 
-void glsprite_render_draw_buffer(const struct glsprite_renderer *rend,
+void glsprite_render_draw_buffer(struct glsprite_renderer *rend,
                                  const struct glsprite_draw_buffer *buf)
 {
+    struct glsprite_render_state *s = rend->state;
     size_t n = buf->num_sprites;
+    int use_regions = buf->sprite_slices != NULL;
 
-    glBindTexture(GL_TEXTURE_2D, buf->sheet->texture_id);
-    glUniform2f(rend->sheet_size_uniform_loc, buf->sheet->width,
-                buf->sheet->height);
+    glsprite_render_state_use_program(s, rend->prog_id);
 
-    glBindVertexArray(rend->vao_id);
+    glsprite_render_state_bind_texture(s, buf->sheet->texture_id);
+    glsprite_render_state_set_sheet_size(s, rend->prog_id,
+                                         rend->sheet_size_uniform_loc,
+                                         buf->sheet->width, buf->sheet->height);
+    /* Programs without the uniform always read the region inputs. */
+    glsprite_render_state_set_use_regions(s, rend->prog_id,
+                                          rend->use_regions_uniform_loc,
+                                          use_regions);
 
-    glBindBuffer(GL_ARRAY_BUFFER, rend->sprite_pos_vbo_id);
+    glsprite_render_state_bind_vertex_array(s, rend->vao_id);
+
+    glsprite_render_state_bind_array_buffer(s, rend->sprite_pos_vbo_id);
     glBufferData(GL_ARRAY_BUFFER, n * sizeof(buf->sprite_positions[0]),
                  buf->sprite_positions, GL_DYNAMIC_DRAW);
 
-    glBindBuffer(GL_ARRAY_BUFFER, rend->sprite_size_vbo_id);
+    glsprite_render_state_bind_array_buffer(s, rend->sprite_size_vbo_id);
     glBufferData(GL_ARRAY_BUFFER, n * sizeof(buf->sprite_dimensions[0]),
                  buf->sprite_dimensions, GL_DYNAMIC_DRAW);
 
-    glBindBuffer(GL_ARRAY_BUFFER, rend->sprite_rot_vbo_id);
+    glsprite_render_state_bind_array_buffer(s, rend->sprite_rot_vbo_id);
     glBufferData(GL_ARRAY_BUFFER, n * sizeof(buf->sprite_angles[0]),
                  buf->sprite_angles, GL_DYNAMIC_DRAW);
 
-    glBindBuffer(GL_ARRAY_BUFFER, rend->sheet_offset_vbo_id);
+    glsprite_render_state_bind_array_buffer(s, rend->sheet_offset_vbo_id);
     glBufferData(GL_ARRAY_BUFFER, n * sizeof(buf->sheet_offsets[0]),
                  buf->sheet_offsets, GL_DYNAMIC_DRAW);
 
-    glBindBuffer(GL_ARRAY_BUFFER, rend->sprite_origin_vbo_id);
+    glsprite_render_state_bind_array_buffer(s, rend->sprite_origin_vbo_id);
     glBufferData(GL_ARRAY_BUFFER, n * sizeof(buf->sprite_origins[0]),
                  buf->sprite_origins, GL_DYNAMIC_DRAW);
 
-    glUseProgram(rend->prog_id);
+    enable_regions(rend, use_regions);
+    if (use_regions) {
+        glsprite_render_state_bind_array_buffer(s, rend->sheet_size_vbo_id);
+        glBufferData(GL_ARRAY_BUFFER, n * sizeof(buf->sheet_dimensions[0]),
+                     buf->sheet_dimensions, GL_DYNAMIC_DRAW);
+
+        glsprite_render_state_bind_array_buffer(s, rend->sprite_slice_vbo_id);
+        glBufferData(GL_ARRAY_BUFFER, n * sizeof(buf->sprite_slices[0]),
+                     buf->sprite_slices, GL_DYNAMIC_DRAW);
+
+        glsprite_render_state_bind_array_buffer(s, rend->sprite_repeat_vbo_id);
+        glBufferData(GL_ARRAY_BUFFER, n * sizeof(buf->sprite_repeats[0]),
+                     buf->sprite_repeats, GL_DYNAMIC_DRAW);
+    }
 
     glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, ARRAY_LEN(quad_verts), n);
 }
 
 void glsprite_renderer_destroy(struct glsprite_renderer *renderer)
 {
+    glsprite_render_state_forget_vertex_array(renderer->state,
+                                              renderer->vao_id);
+
+    glDeleteBuffers(1, &renderer->sprite_repeat_vbo_id);
+    glDeleteBuffers(1, &renderer->sprite_slice_vbo_id);
+    glDeleteBuffers(1, &renderer->sheet_size_vbo_id);
     glDeleteBuffers(1, &renderer->sprite_origin_vbo_id);
     glDeleteBuffers(1, &renderer->sheet_offset_vbo_id);
     glDeleteBuffers(1, &renderer->sprite_rot_vbo_id);
@@ -15,6 +15,30 @@
 #include <vecmat/vec2i.h>
 #include <vecmat/vec2f.h>
 
+/*
+ * Shadow copy of the GL state last set by glsprite, used for skipping
+ * redundant binds and uniform updates. Bindings belong to the GL context, so
+ * every renderer drawing into the same context must share one of these.
+ * Zero ids mean unknown state.
+ */
+struct glsprite_render_state {
+    GLuint prog_id;
+    GLuint vao_id;
+    GLuint array_buffer_id;
+    GLuint texture_id;
+    /* Program whose sheet_size uniform was last set to sheet_width/height. */
+    GLuint sheet_size_prog_id;
+    unsigned sheet_width;
+    unsigned sheet_height;
+    /* Program whose use_regions uniform was last set to use_regions. */
+    GLuint use_regions_prog_id;
+    int use_regions;
+    /* Same for the time uniform, which only the C++ renderer sets. */
+    GLuint time_prog_id;
+    float time;
+    unsigned long num_calls_avoided;
+};
+
 struct glsprite_renderer {
     GLuint prog_id;
     GLuint vao_id;
@@ -24,14 +48,47 @@ struct glsprite_renderer {
     GLuint sprite_rot_vbo_id;
     GLuint sheet_offset_vbo_id;
     GLuint sprite_origin_vbo_id;
+    GLuint sheet_size_vbo_id;
+    GLuint sprite_slice_vbo_id;
+    GLuint sprite_repeat_vbo_id;
     GLint screen_size_uniform_loc;
     GLint sheet_size_uniform_loc;
+    GLint use_regions_uniform_loc;
+    /* Whether the region attribute arrays are enabled in the vertex array. */
+    int regions_enabled;
+    struct glsprite_render_state *state;
 };
 
 struct glsprite_sheet {
     unsigned width;
     unsigned height;
     GLuint texture_id;
+    /* Size of the uploaded texture, 0 when not known. */
+    size_t vram_bytes;
+};
+
+#define GLSPRITE_TEXTURE_MAX_LEVELS 16
+
+enum glsprite_texture_format {
+    GLSPRITE_TEXTURE_RGBA8,
+    /* S3TC DXT1, opaque. */
+    GLSPRITE_TEXTURE_BC1,
+    /* S3TC DXT5, with alpha. */
+    GLSPRITE_TEXTURE_BC3,
+};
+
+struct glsprite_texture_level {
+    unsigned width;
+    unsigned height;
+    size_t size;
+    unsigned char *data;
+};
+
+/* CPU side sheet image with its mip levels, prepared for upload. */
+struct glsprite_texture {
+    enum glsprite_texture_format format;
+    unsigned num_levels;
+    struct glsprite_texture_level levels[GLSPRITE_TEXTURE_MAX_LEVELS];
 };
 
 struct glsprite_grid {
@@ -40,6 +97,17 @@ struct glsprite_grid {
     float margin;
 };
 
+/*
+ * Insets in texels of the fixed size borders of a nine-slice sprite. Only the
+ * area between the insets is stretched or repeated.
+ */
+struct glsprite_slice {
+    float left;
+    float top;
+    float right;
+    float bottom;
+};
+
 struct glsprite_draw_buffer {
     const struct glsprite_sheet *sheet;
     size_t num_sprites;
@@ -49,9 +117,40 @@ struct glsprite_draw_buffer {
     struct vec2f *sprite_dimensions;
     struct vec2f *sprite_origins;
     float *sprite_angles;
+    /* NULL until a region sprite is pushed. */
+    struct vec2f *sheet_dimensions;
+    struct glsprite_slice *sprite_slices;
+    struct vec2f *sprite_repeats;
+    /* Set when the arrays point into a glsprite_snapshot mapping. */
+    int borrowed;
+};
+
+struct glsprite_snapshot {
+    void *map;
+    size_t map_len;
+    const char *sheet_name;
+    unsigned sheet_width;
+    unsigned sheet_height;
+    size_t num_sprites;
+    struct vec2f *sheet_offsets;
+    struct vec2f *sprite_positions;
+    struct vec2f *sprite_dimensions;
+    struct vec2f *sprite_origins;
+    float *sprite_angles;
+    /* NULL if the snapshotted buffer had no region sprites. */
+    struct vec2f *sheet_dimensions;
+    struct glsprite_slice *sprite_slices;
+    struct vec2f *sprite_repeats;
 };
 
-int glsprite_renderer_init(struct glsprite_renderer *r, GLuint prog_id,
+void glsprite_render_state_init(struct glsprite_render_state *state);
+
+/*
+ * The renderer keeps a pointer to state, which must outlive it and be shared
+ * with all other renderers using the same GL context.
+ */
+int glsprite_renderer_init(struct glsprite_renderer *r,
+                           struct glsprite_render_state *state, GLuint prog_id,
                            unsigned screen_w, unsigned screen_h);
 
 void glsprite_sheet_init(struct glsprite_sheet *sheet, GLuint texture_id,
@@ -60,11 +159,82 @@ void glsprite_sheet_init(struct glsprite_sheet *sheet, GLuint texture_id,
 void glsprite_draw_buffer_init(struct glsprite_draw_buffer *buf,
                                const struct glsprite_sheet *sheet);
 
+/*
+ * Copies the sprites of an RGBA8 sheet laid out according to grid into a new
+ * texture where each sprite has a gutter of extruded edge texels wide enough
+ * for num_levels mip levels not to bleed between neighbours. The cells are
+ * aligned so that no compression block of those levels spans two sprites. The
+ * layout of the new sheet is stored in padded_grid. Returns 0 on success and
+ * -1 on failure.
+ */
+int glsprite_texture_pad(struct glsprite_texture *tex,
+                         struct glsprite_grid *padded_grid,
+                         const unsigned char *rgba, unsigned width,
+                         unsigned height, const struct glsprite_grid *grid,
+                         unsigned num_levels);
+
+/*
+ * Box filters an RGBA8 texture down to at most num_levels mip levels. Fails
+ * if the texture has no base level.
+ */
+int glsprite_texture_gen_mipmaps(struct glsprite_texture *tex,
+                                 unsigned num_levels);
+
+/* Compresses all levels of an RGBA8 texture into the given block format. */
+int glsprite_texture_compress(struct glsprite_texture *tex,
+                              enum glsprite_texture_format format);
+
+/* Requires a current GL context. */
+int glsprite_texture_format_supported(enum glsprite_texture_format format);
+
+/*
+ * Uploads the texture and initializes the sheet with it. The size of the
+ * uploaded levels is stored in sheet->vram_bytes. The GL error state is
+ * checked after each level, so an error left pending by earlier GL calls also
+ * makes this fail. Returns 0 on success and -1 on failure.
+ */
+int glsprite_sheet_init_texture(struct glsprite_sheet *sheet,
+                                const struct glsprite_texture *tex);
+
+/*
+ * Writes the texture and the padded grid returned by glsprite_texture_pad
+ * into a file, so the padding, mipmapping and compression can be done
+ * offline. Returns 0 on success and -1 on failure.
+ */
+int glsprite_texture_write(const char *path,
+                           const struct glsprite_texture *tex,
+                           const struct glsprite_grid *grid);
+
+/*
+ * Reads a file written by glsprite_texture_write. The texture has to be freed
+ * with glsprite_texture_destroy. Returns 0 on success and -1 on failure.
+ */
+int glsprite_texture_load(struct glsprite_texture *tex,
+                          struct glsprite_grid *grid, const char *path);
+
+void glsprite_texture_destroy(struct glsprite_texture *tex);
+
+/*
+ * Deletes the sheet texture and drops it from state, which may be NULL if the
+ * sheet was never rendered with.
+ */
+void glsprite_sheet_destroy(struct glsprite_sheet *sheet,
+                            struct glsprite_render_state *state);
+
 void glsprite_grid_init(struct glsprite_grid *grid, unsigned sprite_width,
                         unsigned sprite_height, unsigned margin);
 
 void glsprite_draw_buffer_grow(struct glsprite_draw_buffer *buf);
 
+/*
+ * Allocates the sheet_dimensions, sprite_slices and sprite_repeats arrays and
+ * fills them in for the sprites already in the buffer. Buffers without them
+ * only upload the plain sprite attributes. Called by the region push
+ * functions on first use, the arrays are kept until the buffer is destroyed.
+ * Does nothing if the buffer already has them.
+ */
+void glsprite_draw_buffer_add_regions(struct glsprite_draw_buffer *buf);
+
 static inline void glsprite_draw_buffer_push(struct glsprite_draw_buffer *buf,
                                              struct vec2f sheet_pos,
                                              struct vec2f sprite_pos,
@@ -72,6 +242,7 @@ static inline void glsprite_draw_buffer_push(struct glsprite_draw_buffer *buf,
                                              struct vec2f sprite_orig,
                                              float sprite_angle)
 {
+    static const struct glsprite_slice no_slice = { 0.0f, 0.0f, 0.0f, 0.0f };
     size_t i = buf->num_sprites;
 
     if (buf->num_sprites >= buf->num_allocd || buf->num_allocd == 0)
@@ -83,9 +254,44 @@ static inline void glsprite_draw_buffer_push(struct glsprite_draw_buffer *buf,
     buf->sprite_origins[i] = sprite_orig;
     buf->sprite_angles[i] = sprite_angle;
 
+    if (buf->sprite_slices) {
+        buf->sheet_dimensions[i] = sprite_dim;
+        buf->sprite_slices[i] = no_slice;
+        buf->sprite_repeats[i] = vec2f_init(1.0f, 1.0f);
+    }
+
     buf->num_sprites = i + 1;
 }
 
+/*
+ * Pushes a sprite whose sheet_dim sized area at sheet_pos is drawn stretched
+ * over sprite_dim. The area inside the slice insets is repeated repeat times
+ * along each axis, the borders outside of it are drawn unscaled.
+ */
+static inline void
+glsprite_draw_buffer_push_region(struct glsprite_draw_buffer *buf,
+                                 struct vec2f sheet_pos,
+                                 struct vec2f sheet_dim,
+                                 const struct glsprite_slice *slice,
+                                 struct vec2f repeat,
+                                 struct vec2f sprite_pos,
+                                 struct vec2f sprite_dim,
+                                 struct vec2f sprite_orig,
+                                 float sprite_angle)
+{
+    size_t i = buf->num_sprites;
+
+    if (!buf->sprite_slices)
+        glsprite_draw_buffer_add_regions(buf);
+
+    glsprite_draw_buffer_push(buf, sheet_pos, sprite_pos, sprite_dim,
+                              sprite_orig, sprite_angle);
+
+    buf->sheet_dimensions[i] = sheet_dim;
+    buf->sprite_slices[i] = *slice;
+    buf->sprite_repeats[i] = repeat;
+}
+
 void glsprite_draw_buffer_push_grid(struct glsprite_draw_buffer *buf,
                                     const struct glsprite_grid *grid,
                                     struct vec2i sprite_idx,
@@ -93,15 +299,109 @@ void glsprite_draw_buffer_push_grid(struct glsprite_draw_buffer *buf,
                                     struct vec2f sprite_orig,
                                     float sprite_angle);
 
-void glsprite_render_draw_buffer(const struct glsprite_renderer *rend,
+/* Pushes a panel with fixed size borders and a stretched center. */
+void glsprite_draw_buffer_push_nine_slice(struct glsprite_draw_buffer *buf,
+                                          struct vec2f sheet_pos,
+                                          struct vec2f sheet_dim,
+                                          const struct glsprite_slice *slice,
+                                          struct vec2f sprite_pos,
+                                          struct vec2f sprite_dim,
+                                          struct vec2f sprite_orig,
+                                          float sprite_angle);
+
+/* Pushes a single instance covering repeat.x * repeat.y copies of a sprite. */
+void glsprite_draw_buffer_push_tiled(struct glsprite_draw_buffer *buf,
+                                     struct vec2f sheet_pos,
+                                     struct vec2f sheet_dim,
+                                     struct vec2i repeat,
+                                     struct vec2f sprite_pos,
+                                     struct vec2f sprite_orig,
+                                     float sprite_angle);
+
+void glsprite_render_draw_buffer(struct glsprite_renderer *rend,
                                  const struct glsprite_draw_buffer *buf);
 
+/*
+ * Forgets the shadowed GL state. Must be called if the program, vertex array,
+ * array buffer or texture bindings or the sheet_size uniform are changed
+ * outside of glsprite between glsprite_render_draw_buffer calls. Deleting
+ * programs, vertex arrays, buffers or textures by other means than the
+ * glsprite destroy functions also counts as such a change.
+ */
+void glsprite_render_state_invalidate(struct glsprite_render_state *state);
+
+/*
+ * Shadowed GL calls, for renderers of their own that share the state with
+ * glsprite_renderer. Each call is skipped if the state shows it would not
+ * change anything. The uniform setters expect prog_id to be in use and do
+ * nothing for negative locations, as returned for uniforms the program lacks.
+ */
+void glsprite_render_state_use_program(struct glsprite_render_state *state,
+                                       GLuint prog_id);
+
+void
+glsprite_render_state_bind_vertex_array(struct glsprite_render_state *state,
+                                        GLuint vao_id);
+
+void
+glsprite_render_state_bind_array_buffer(struct glsprite_render_state *state,
+                                        GLuint vbo_id);
+
+void glsprite_render_state_bind_texture(struct glsprite_render_state *state,
+                                        GLuint texture_id);
+
+void glsprite_render_state_set_sheet_size(struct glsprite_render_state *state,
+                                          GLuint prog_id, GLint loc,
+                                          unsigned width, unsigned height);
+
+void glsprite_render_state_set_use_regions(struct glsprite_render_state *state,
+                                           GLuint prog_id, GLint loc,
+                                           int use_regions);
+
+void glsprite_render_state_set_time(struct glsprite_render_state *state,
+                                    GLuint prog_id, GLint loc, float time);
+
+/*
+ * Drops a vertex array that is about to be deleted and the array buffer
+ * binding from the state.
+ */
+void
+glsprite_render_state_forget_vertex_array(struct glsprite_render_state *state,
+                                          GLuint vao_id);
+
 static inline void glsprite_draw_buffer_clear(struct glsprite_draw_buffer *buf)
 {
     buf->num_sprites = 0;
 }
 
 void glsprite_draw_buffer_destroy(struct glsprite_draw_buffer *buf);
+
+/*
+ * Writes the contents of the draw buffer into a binary snapshot file. The
+ * sheet_name is stored in the file so that the loader can tell which sheet the
+ * sprites refer to. Returns 0 on success and -1 on failure.
+ */
+int glsprite_snapshot_write(const char *path,
+                            const struct glsprite_draw_buffer *buf,
+                            const char *sheet_name);
+
+/*
+ * Maps a snapshot file written by glsprite_snapshot_write. Returns 0 on
+ * success and -1 on failure.
+ */
+int glsprite_snapshot_open(struct glsprite_snapshot *snap, const char *path);
+
+/*
+ * Points the draw buffer straight at the snapshot arrays without copying. The
+ * snapshot has to outlive the draw buffer. Growing the buffer copies the
+ * arrays to the heap. Returns -1 if the sheet dimensions do not match the ones
+ * in the snapshot.
+ */
+int glsprite_draw_buffer_init_snapshot(struct glsprite_draw_buffer *buf,
+                                       const struct glsprite_sheet *sheet,
+                                       const struct glsprite_snapshot *snap);
+
+void glsprite_snapshot_close(struct glsprite_snapshot *snap);
 void glsprite_renderer_destroy(struct glsprite_renderer *renderer);
 
 #endif
@@ -12,11 +12,45 @@
 #include <GL/gl.h>
 #endif
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
 #include <vecmat/vec2i.h>
 #include <vecmat/vec2f.h>
 
 extern "C" {
 
+/*
+ * Shadow copy of the GL state last set by glsprite, used for skipping
+ * redundant binds and uniform updates. Bindings belong to the GL context, so
+ * every renderer drawing into the same context must share one of these.
+ * Zero ids mean unknown state.
+ */
+struct glsprite_render_state {
+    GLuint prog_id;
+    GLuint vao_id;
+    GLuint array_buffer_id;
+    GLuint texture_id;
+    /* Program whose sheet_size uniform was last set to sheet_width/height. */
+    GLuint sheet_size_prog_id;
+    unsigned sheet_width;
+    unsigned sheet_height;
+    /* Program whose use_regions uniform was last set to use_regions. */
+    GLuint use_regions_prog_id;
+    int use_regions;
+    /* Same for the time uniform, which only the C++ renderer sets. */
+    GLuint time_prog_id;
+    float time;
+    unsigned long num_calls_avoided;
+};
+
 struct glsprite_renderer {
     GLuint prog_id;
     GLuint vao_id;
@@ -26,14 +60,47 @@ struct glsprite_renderer {
     GLuint sprite_rot_vbo_id;
     GLuint sheet_offset_vbo_id;
     GLuint sprite_origin_vbo_id;
+    GLuint sheet_size_vbo_id;
+    GLuint sprite_slice_vbo_id;
+    GLuint sprite_repeat_vbo_id;
     GLint screen_size_uniform_loc;
     GLint sheet_size_uniform_loc;
+    GLint use_regions_uniform_loc;
+    /* Whether the region attribute arrays are enabled in the vertex array. */
+    int regions_enabled;
+    struct glsprite_render_state *state;
 };
 
 struct glsprite_sheet {
     unsigned width;
     unsigned height;
     GLuint texture_id;
+    /* Size of the uploaded texture, 0 when not known. */
+    size_t vram_bytes;
+};
+
+#define GLSPRITE_TEXTURE_MAX_LEVELS 16
+
+enum glsprite_texture_format {
+    GLSPRITE_TEXTURE_RGBA8,
+    /* S3TC DXT1, opaque. */
+    GLSPRITE_TEXTURE_BC1,
+    /* S3TC DXT5, with alpha. */
+    GLSPRITE_TEXTURE_BC3,
+};
+
+struct glsprite_texture_level {
+    unsigned width;
+    unsigned height;
+    size_t size;
+    unsigned char *data;
+};
+
+/* CPU side sheet image with its mip levels, prepared for upload. */
+struct glsprite_texture {
+    enum glsprite_texture_format format;
+    unsigned num_levels;
+    struct glsprite_texture_level levels[GLSPRITE_TEXTURE_MAX_LEVELS];
 };
 
 struct glsprite_grid {
@@ -42,6 +109,17 @@ struct glsprite_grid {
     float margin;
 };
 
+/*
+ * Insets in texels of the fixed size borders of a nine-slice sprite. Only the
+ * area between the insets is stretched or repeated.
+ */
+struct glsprite_slice {
+    float left;
+    float top;
+    float right;
+    float bottom;
+};
+
 struct glsprite_draw_buffer {
     const struct glsprite_sheet *sheet;
     size_t num_sprites;
@@ -51,9 +129,40 @@ struct glsprite_draw_buffer {
     struct vm::vec2f *sprite_dimensions;
     struct vm::vec2f *sprite_origins;
     float *sprite_angles;
+    /* NULL until a region sprite is pushed. */
+    struct vm::vec2f *sheet_dimensions;
+    struct glsprite_slice *sprite_slices;
+    struct vm::vec2f *sprite_repeats;
+    /* Set when the arrays point into a glsprite_snapshot mapping. */
+    int borrowed;
+};
+
+struct glsprite_snapshot {
+    void *map;
+    size_t map_len;
+    const char *sheet_name;
+    unsigned sheet_width;
+    unsigned sheet_height;
+    size_t num_sprites;
+    struct vm::vec2f *sheet_offsets;
+    struct vm::vec2f *sprite_positions;
+    struct vm::vec2f *sprite_dimensions;
+    struct vm::vec2f *sprite_origins;
+    float *sprite_angles;
+    /* NULL if the snapshotted buffer had no region sprites. */
+    struct vm::vec2f *sheet_dimensions;
+    struct glsprite_slice *sprite_slices;
+    struct vm::vec2f *sprite_repeats;
 };
 
-int glsprite_renderer_init(struct glsprite_renderer *r, GLuint prog_id,
+void glsprite_render_state_init(struct glsprite_render_state *state);
+
+/*
+ * The renderer keeps a pointer to state, which must outlive it and be shared
+ * with all other renderers using the same GL context.
+ */
+int glsprite_renderer_init(struct glsprite_renderer *r,
+                           struct glsprite_render_state *state, GLuint prog_id,
                            unsigned screen_w, unsigned screen_h);
 
 void glsprite_sheet_init(struct glsprite_sheet *sheet, GLuint texture_id,
@@ -62,11 +171,82 @@ void glsprite_sheet_init(struct glsprite_sheet *sheet, GLuint texture_id,
 void glsprite_draw_buffer_init(struct glsprite_draw_buffer *buf,
                                const struct glsprite_sheet *sheet);
 
+/*
+ * Copies the sprites of an RGBA8 sheet laid out according to grid into a new
+ * texture where each sprite has a gutter of extruded edge texels wide enough
+ * for num_levels mip levels not to bleed between neighbours. The cells are
+ * aligned so that no compression block of those levels spans two sprites. The
+ * layout of the new sheet is stored in padded_grid. Returns 0 on success and
+ * -1 on failure.
+ */
+int glsprite_texture_pad(struct glsprite_texture *tex,
+                         struct glsprite_grid *padded_grid,
+                         const unsigned char *rgba, unsigned width,
+                         unsigned height, const struct glsprite_grid *grid,
+                         unsigned num_levels);
+
+/*
+ * Box filters an RGBA8 texture down to at most num_levels mip levels. Fails
+ * if the texture has no base level.
+ */
+int glsprite_texture_gen_mipmaps(struct glsprite_texture *tex,
+                                 unsigned num_levels);
+
+/* Compresses all levels of an RGBA8 texture into the given block format. */
+int glsprite_texture_compress(struct glsprite_texture *tex,
+                              enum glsprite_texture_format format);
+
+/* Requires a current GL context. */
+int glsprite_texture_format_supported(enum glsprite_texture_format format);
+
+/*
+ * Uploads the texture and initializes the sheet with it. The size of the
+ * uploaded levels is stored in sheet->vram_bytes. The GL error state is
+ * checked after each level, so an error left pending by earlier GL calls also
+ * makes this fail. Returns 0 on success and -1 on failure.
+ */
+int glsprite_sheet_init_texture(struct glsprite_sheet *sheet,
+                                const struct glsprite_texture *tex);
+
+/*
+ * Writes the texture and the padded grid returned by glsprite_texture_pad
+ * into a file, so the padding, mipmapping and compression can be done
+ * offline. Returns 0 on success and -1 on failure.
+ */
+int glsprite_texture_write(const char *path,
+                           const struct glsprite_texture *tex,
+                           const struct glsprite_grid *grid);
+
+/*
+ * Reads a file written by glsprite_texture_write. The texture has to be freed
+ * with glsprite_texture_destroy. Returns 0 on success and -1 on failure.
+ */
+int glsprite_texture_load(struct glsprite_texture *tex,
+                          struct glsprite_grid *grid, const char *path);
+
+void glsprite_texture_destroy(struct glsprite_texture *tex);
+
+/*
+ * Deletes the sheet texture and drops it from state, which may be NULL if the
+ * sheet was never rendered with.
+ */
+void glsprite_sheet_destroy(struct glsprite_sheet *sheet,
+                            struct glsprite_render_state *state);
+
 void glsprite_grid_init(struct glsprite_grid *grid, unsigned sprite_width,
                         unsigned sprite_height, unsigned margin);
 
 void glsprite_draw_buffer_grow(struct glsprite_draw_buffer *buf);
 
+/*
+ * Allocates the sheet_dimensions, sprite_slices and sprite_repeats arrays and
+ * fills them in for the sprites already in the buffer. Buffers without them
+ * only upload the plain sprite attributes. Called by the region push
+ * functions on first use, the arrays are kept until the buffer is destroyed.
+ * Does nothing if the buffer already has them.
+ */
+void glsprite_draw_buffer_add_regions(struct glsprite_draw_buffer *buf);
+
 static inline void glsprite_draw_buffer_push(struct glsprite_draw_buffer *buf,
                                              struct vm::vec2f sheet_pos,
                                              struct vm::vec2f sprite_pos,
@@ -74,6 +254,7 @@ static inline void glsprite_draw_buffer_push(struct glsprite_draw_buffer *buf,
                                              struct vm::vec2f sprite_orig,
                                              float sprite_angle)
 {
+    static const struct glsprite_slice no_slice = { 0.0f, 0.0f, 0.0f, 0.0f };
     size_t i = buf->num_sprites;
 
     if (buf->num_sprites >= buf->num_allocd || buf->num_allocd == 0)
@@ -85,9 +266,44 @@ static inline void glsprite_draw_buffer_push(struct glsprite_draw_buffer *buf,
     buf->sprite_origins[i] = sprite_orig;
     buf->sprite_angles[i] = sprite_angle;
 
+    if (buf->sprite_slices) {
+        buf->sheet_dimensions[i] = sprite_dim;
+        buf->sprite_slices[i] = no_slice;
+        buf->sprite_repeats[i] = vm::vec2f_init(1.0f, 1.0f);
+    }
+
     buf->num_sprites = i + 1;
 }
 
+/*
+ * Pushes a sprite whose sheet_dim sized area at sheet_pos is drawn stretched
+ * over sprite_dim. The area inside the slice insets is repeated repeat times
+ * along each axis, the borders outside of it are drawn unscaled.
+ */
+static inline void
+glsprite_draw_buffer_push_region(struct glsprite_draw_buffer *buf,
+                                 struct vm::vec2f sheet_pos,
+                                 struct vm::vec2f sheet_dim,
+                                 const struct glsprite_slice *slice,
+                                 struct vm::vec2f repeat,
+                                 struct vm::vec2f sprite_pos,
+                                 struct vm::vec2f sprite_dim,
+                                 struct vm::vec2f sprite_orig,
+                                 float sprite_angle)
+{
+    size_t i = buf->num_sprites;
+
+    if (!buf->sprite_slices)
+        glsprite_draw_buffer_add_regions(buf);
+
+    glsprite_draw_buffer_push(buf, sheet_pos, sprite_pos, sprite_dim,
+                              sprite_orig, sprite_angle);
+
+    buf->sheet_dimensions[i] = sheet_dim;
+    buf->sprite_slices[i] = *slice;
+    buf->sprite_repeats[i] = repeat;
+}
+
 void glsprite_draw_buffer_push_grid(struct glsprite_draw_buffer *buf,
                                     const struct glsprite_grid *grid,
                                     struct vm::vec2i sprite_idx,
@@ -95,17 +311,585 @@ void glsprite_draw_buffer_push_grid(struct glsprite_draw_buffer *buf,
                                     struct vm::vec2f sprite_orig,
                                     float sprite_angle);
 
-void glsprite_render_draw_buffer(const struct glsprite_renderer *rend,
+/* Pushes a panel with fixed size borders and a stretched center. */
+void glsprite_draw_buffer_push_nine_slice(struct glsprite_draw_buffer *buf,
+                                          struct vm::vec2f sheet_pos,
+                                          struct vm::vec2f sheet_dim,
+                                          const struct glsprite_slice *slice,
+                                          struct vm::vec2f sprite_pos,
+                                          struct vm::vec2f sprite_dim,
+                                          struct vm::vec2f sprite_orig,
+                                          float sprite_angle);
+
+/* Pushes a single instance covering repeat.x * repeat.y copies of a sprite. */
+void glsprite_draw_buffer_push_tiled(struct glsprite_draw_buffer *buf,
+                                     struct vm::vec2f sheet_pos,
+                                     struct vm::vec2f sheet_dim,
+                                     struct vm::vec2i repeat,
+                                     struct vm::vec2f sprite_pos,
+                                     struct vm::vec2f sprite_orig,
+                                     float sprite_angle);
+
+void glsprite_render_draw_buffer(struct glsprite_renderer *rend,
                                  const struct glsprite_draw_buffer *buf);
 
+/*
+ * Forgets the shadowed GL state. Must be called if the program, vertex array,
+ * array buffer or texture bindings or the sheet_size uniform are changed
+ * outside of glsprite between glsprite_render_draw_buffer calls. Deleting
+ * programs, vertex arrays, buffers or textures by other means than the
+ * glsprite destroy functions also counts as such a change.
+ */
+void glsprite_render_state_invalidate(struct glsprite_render_state *state);
+
+/*
+ * Shadowed GL calls, for renderers of their own that share the state with
+ * glsprite_renderer. Each call is skipped if the state shows it would not
+ * change anything. The uniform setters expect prog_id to be in use and do
+ * nothing for negative locations, as returned for uniforms the program lacks.
+ */
+void glsprite_render_state_use_program(struct glsprite_render_state *state,
+                                       GLuint prog_id);
+
+void
+glsprite_render_state_bind_vertex_array(struct glsprite_render_state *state,
+                                        GLuint vao_id);
+
+void
+glsprite_render_state_bind_array_buffer(struct glsprite_render_state *state,
+                                        GLuint vbo_id);
+
+void glsprite_render_state_bind_texture(struct glsprite_render_state *state,
+                                        GLuint texture_id);
+
+void glsprite_render_state_set_sheet_size(struct glsprite_render_state *state,
+                                          GLuint prog_id, GLint loc,
+                                          unsigned width, unsigned height);
+
+void glsprite_render_state_set_use_regions(struct glsprite_render_state *state,
+                                           GLuint prog_id, GLint loc,
+                                           int use_regions);
+
+void glsprite_render_state_set_time(struct glsprite_render_state *state,
+                                    GLuint prog_id, GLint loc, float time);
+
+/*
+ * Drops a vertex array that is about to be deleted and the array buffer
+ * binding from the state.
+ */
+void
+glsprite_render_state_forget_vertex_array(struct glsprite_render_state *state,
+                                          GLuint vao_id);
+
 static inline void glsprite_draw_buffer_clear(struct glsprite_draw_buffer *buf)
 {
     buf->num_sprites = 0;
 }
 
 void glsprite_draw_buffer_destroy(struct glsprite_draw_buffer *buf);
+
+/*
+ * Writes the contents of the draw buffer into a binary snapshot file. The
+ * sheet_name is stored in the file so that the loader can tell which sheet the
+ * sprites refer to. Returns 0 on success and -1 on failure.
+ */
+int glsprite_snapshot_write(const char *path,
+                            const struct glsprite_draw_buffer *buf,
+                            const char *sheet_name);
+
+/*
+ * Maps a snapshot file written by glsprite_snapshot_write. Returns 0 on
+ * success and -1 on failure.
+ */
+int glsprite_snapshot_open(struct glsprite_snapshot *snap, const char *path);
+
+/*
+ * Points the draw buffer straight at the snapshot arrays without copying. The
+ * snapshot has to outlive the draw buffer. Growing the buffer copies the
+ * arrays to the heap. Returns -1 if the sheet dimensions do not match the ones
+ * in the snapshot.
+ */
+int glsprite_draw_buffer_init_snapshot(struct glsprite_draw_buffer *buf,
+                                       const struct glsprite_sheet *sheet,
+                                       const struct glsprite_snapshot *snap);
+
+void glsprite_snapshot_close(struct glsprite_snapshot *snap);
 void glsprite_renderer_destroy(struct glsprite_renderer *renderer);
 
 } /* extern "C" */
 
+/*
+ * Template front-end. The instance attributes of a draw buffer are chosen at
+ * compile time and its storage, vertex array setup and vertex shader inputs
+ * are all generated from that list. The GL 3.3 entry points have to be
+ * declared before including this header, e.g. by GLEW.
+ */
+namespace glsprite {
+
+namespace attr {
+
+struct rgba8 {
+    std::uint8_t r, g, b, a;
+};
+
+struct i16vec2 {
+    std::int16_t x, y;
+};
+
+/* The sheet offset advances by stride for each frame, rate frames a second. */
+struct anim {
+    vm::vec2f stride;
+    float num_frames;
+    float rate;
+};
+
+template <class T, GLint Components, GLenum Type, GLboolean Normalized>
+struct format {
+    using value_type = T;
+    static constexpr GLint components = Components;
+    static constexpr GLenum gl_type = Type;
+    static constexpr GLboolean normalized = Normalized;
+};
+
+struct position : format<vm::vec2f, 2, GL_FLOAT, GL_FALSE> {
+    static constexpr const char *glsl_type = "vec2";
+    static constexpr const char *glsl_name = "sprite_pos";
+    static constexpr const char *glsl_default = "vec2(0.0)";
+};
+
+/*
+ * Positions stored as int16 pixel coordinates, half the size of position.
+ * Feeds the same shader input, so a buffer can only have one of the two.
+ */
+struct quantized_position : format<i16vec2, 2, GL_SHORT, GL_FALSE> {
+    static constexpr const char *glsl_type = "vec2";
+    static constexpr const char *glsl_name = "sprite_pos";
+    static constexpr const char *glsl_default = "vec2(0.0)";
+};
+
+struct size : format<vm::vec2f, 2, GL_FLOAT, GL_FALSE> {
+    static constexpr const char *glsl_type = "vec2";
+    static constexpr const char *glsl_name = "sprite_size";
+    static constexpr const char *glsl_default = "vec2(0.0)";
+};
+
+struct rotation : format<float, 1, GL_FLOAT, GL_FALSE> {
+    static constexpr const char *glsl_type = "float";
+    static constexpr const char *glsl_name = "sprite_rot";
+    static constexpr const char *glsl_default = "0.0";
+};
+
+struct sheet_offset : format<vm::vec2f, 2, GL_FLOAT, GL_FALSE> {
+    static constexpr const char *glsl_type = "vec2";
+    static constexpr const char *glsl_name = "sheet_offset";
+    static constexpr const char *glsl_default = "vec2(0.0)";
+};
+
+struct origin : format<vm::vec2f, 2, GL_FLOAT, GL_FALSE> {
+    static constexpr const char *glsl_type = "vec2";
+    static constexpr const char *glsl_name = "sprite_origin";
+    static constexpr const char *glsl_default = "vec2(0.0)";
+};
+
+struct sheet_region : format<vm::vec2f, 2, GL_FLOAT, GL_FALSE> {
+    static constexpr const char *glsl_type = "vec2";
+    static constexpr const char *glsl_name = "sheet_region_size";
+    static constexpr const char *glsl_default = "sprite_size";
+};
+
+struct slice : format<glsprite_slice, 4, GL_FLOAT, GL_FALSE> {
+    static constexpr const char *glsl_type = "vec4";
+    static constexpr const char *glsl_name = "sprite_slice";
+    static constexpr const char *glsl_default = "vec4(0.0)";
+};
+
+struct repeat : format<vm::vec2f, 2, GL_FLOAT, GL_FALSE> {
+    static constexpr const char *glsl_type = "vec2";
+    static constexpr const char *glsl_name = "sprite_repeat";
+    static constexpr const char *glsl_default = "vec2(1.0)";
+};
+
+struct tint : format<rgba8, 4, GL_UNSIGNED_BYTE, GL_TRUE> {
+    static constexpr const char *glsl_type = "vec4";
+    static constexpr const char *glsl_name = "sprite_tint";
+    static constexpr const char *glsl_default = "vec4(1.0)";
+};
+
+/*
+ * Sprites on higher layers are drawn in front of lower ones, any float is
+ * accepted. Needs GL_DEPTH_TEST with GL_LESS or GL_LEQUAL, without a depth
+ * test the sprites are drawn in buffer order. See shader/vs.glsl.
+ */
+struct layer : format<float, 1, GL_FLOAT, GL_FALSE> {
+    static constexpr const char *glsl_type = "float";
+    static constexpr const char *glsl_name = "sprite_layer";
+    static constexpr const char *glsl_default = "0.0";
+};
+
+struct animation : format<anim, 4, GL_FLOAT, GL_FALSE> {
+    static constexpr const char *glsl_type = "vec4";
+    static constexpr const char *glsl_name = "sprite_anim";
+    static constexpr const char *glsl_default = "vec4(0.0, 0.0, 1.0, 0.0)";
+};
+
+/* The vertex shader inputs, missing ones are replaced with their defaults. */
+using all = std::tuple<position, size, rotation, sheet_offset, origin,
+                       sheet_region, slice, repeat, tint, layer, animation>;
+
+} /* namespace attr */
+
+namespace detail {
+
+template <class A, class... As>
+struct index_of;
+
+template <class A, class... As>
+struct index_of<A, A, As...> : std::integral_constant<std::size_t, 0> {};
+
+template <class A, class B, class... As>
+struct index_of<A, B, As...>
+    : std::integral_constant<std::size_t, 1 + index_of<A, As...>::value> {};
+
+constexpr std::size_t gl_type_size(GLenum type)
+{
+    switch (type) {
+    case GL_BYTE:
+    case GL_UNSIGNED_BYTE:
+        return 1;
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+template <class A>
+constexpr bool is_packed =
+    sizeof(typename A::value_type) == A::components * gl_type_size(A::gl_type);
+
+template <class A, class... As>
+constexpr std::size_t count = (std::size_t(std::is_same_v<A, As>) + ...);
+
+constexpr bool str_eq(const char *a, const char *b)
+{
+    return *a == *b && (*a == '\0' || str_eq(a + 1, b + 1));
+}
+
+template <class A, class... As>
+constexpr std::size_t count_glsl_name =
+    (std::size_t(str_eq(A::glsl_name, As::glsl_name)) + ...);
+
+template <class... Attrs>
+bool declares(const std::string &name)
+{
+    return ((name == Attrs::glsl_name) || ...);
+}
+
+struct buffer_traits {
+    static void gen(GLuint *id) { glGenBuffers(1, id); }
+    static void del(GLuint id) { glDeleteBuffers(1, &id); }
+};
+
+struct vertex_array_traits {
+    static void gen(GLuint *id) { glGenVertexArrays(1, id); }
+    static void del(GLuint id) { glDeleteVertexArrays(1, &id); }
+};
+
+/*
+ * Points to the render state shared by the renderers of a GL context. The
+ * owner's vertex array and buffers are dropped from it on destruction, as
+ * deleted names may be handed out again.
+ */
+class state_ptr {
+public:
+    state_ptr() = default;
+    state_ptr(glsprite_render_state *state, GLuint vao_id)
+        : state_(state), vao_id_(vao_id)
+    {
+    }
+    ~state_ptr() { forget(); }
+
+    state_ptr(state_ptr &&other) noexcept
+        : state_(std::exchange(other.state_, nullptr)), vao_id_(other.vao_id_)
+    {
+    }
+
+    state_ptr &operator=(state_ptr &&other) noexcept
+    {
+        if (this != &other) {
+            forget();
+            state_ = std::exchange(other.state_, nullptr);
+            vao_id_ = other.vao_id_;
+        }
+        return *this;
+    }
+
+    glsprite_render_state *get() const { return state_; }
+    glsprite_render_state *operator->() const { return state_; }
+
+private:
+    void forget()
+    {
+        if (state_)
+            glsprite_render_state_forget_vertex_array(state_, vao_id_);
+    }
+
+    glsprite_render_state *state_ = nullptr;
+    GLuint vao_id_ = 0;
+};
+
+} /* namespace detail */
+
+/* Move-only owner of a GL object, created on construction. */
+template <class Traits>
+class gl_object {
+public:
+    gl_object() { Traits::gen(&id_); }
+    ~gl_object() { reset(); }
+
+    gl_object(const gl_object &) = delete;
+    gl_object &operator=(const gl_object &) = delete;
+
+    gl_object(gl_object &&other) noexcept : id_(std::exchange(other.id_, 0)) {}
+
+    gl_object &operator=(gl_object &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            id_ = std::exchange(other.id_, 0);
+        }
+        return *this;
+    }
+
+    GLuint id() const { return id_; }
+
+private:
+    void reset()
+    {
+        if (id_)
+            Traits::del(id_);
+        id_ = 0;
+    }
+
+    GLuint id_ = 0;
+};
+
+using buffer = gl_object<detail::buffer_traits>;
+using vertex_array = gl_object<detail::vertex_array_traits>;
+
+template <class... Attrs>
+class draw_buffer {
+    static_assert(sizeof...(Attrs) > 0, "a draw buffer needs attributes");
+    static_assert(((detail::count<Attrs, Attrs...> == 1) && ...),
+                  "instance attributes must be unique");
+    static_assert(((detail::count_glsl_name<Attrs, Attrs...> == 1) && ...),
+                  "instance attributes must feed distinct shader inputs");
+    static_assert((detail::is_packed<Attrs> && ...),
+                  "instance attribute types must be tightly packed");
+
+public:
+    explicit draw_buffer(const glsprite_sheet &sheet) : sheet_(&sheet) {}
+
+    /* Takes one value per attribute, in the order of Attrs. */
+    void push(const typename Attrs::value_type &...values)
+    {
+        push(std::index_sequence_for<Attrs...>(), values...);
+    }
+
+    template <class A>
+    std::vector<typename A::value_type> &get()
+    {
+        return std::get<detail::index_of<A, Attrs...>::value>(arrays_);
+    }
+
+    template <class A>
+    const std::vector<typename A::value_type> &get() const
+    {
+        return std::get<detail::index_of<A, Attrs...>::value>(arrays_);
+    }
+
+    std::size_t size() const { return std::get<0>(arrays_).size(); }
+
+    void reserve(std::size_t n)
+    {
+        std::apply([n](auto &...arrays) { (arrays.reserve(n), ...); }, arrays_);
+    }
+
+    void clear()
+    {
+        std::apply([](auto &...arrays) { (arrays.clear(), ...); }, arrays_);
+    }
+
+    const glsprite_sheet &sheet() const { return *sheet_; }
+
+    /*
+     * Inserts the vertex shader inputs matching this buffer right after the
+     * #version line of src.
+     */
+    static std::string vertex_shader_source(const std::string &src)
+    {
+        std::string decls = "#define GLSPRITE_ATTRIBS\n"
+                            "layout(location = 0) in vec3 quad_vert_pos;\n";
+        std::size_t eol = src.find('\n');
+        GLuint loc = 1;
+
+        ((decls += "layout(location = " + std::to_string(loc++) + ") in " +
+                   Attrs::glsl_type + " " + Attrs::glsl_name + ";\n"),
+         ...);
+
+        std::apply([&decls](auto... a) {
+            ((detail::declares<Attrs...>(decltype(a)::glsl_name) ||
+              (decls += std::string("#define ") + decltype(a)::glsl_name +
+                        " " + decltype(a)::glsl_default + "\n", true)),
+             ...);
+        }, attr::all());
+
+        if (eol == std::string::npos)
+            return src;
+
+        return src.substr(0, eol + 1) + decls + src.substr(eol + 1);
+    }
+
+private:
+    template <std::size_t... I>
+    void push(std::index_sequence<I...>,
+              const typename Attrs::value_type &...values)
+    {
+        (std::get<I>(arrays_).push_back(values), ...);
+    }
+
+    const glsprite_sheet *sheet_;
+    std::tuple<std::vector<typename Attrs::value_type>...> arrays_;
+};
+
+/*
+ * Renders draw_buffer<Attrs...>. Like glsprite_renderer it skips redundant
+ * state changes through a glsprite_render_state, which has to be shared with
+ * all other C and C++ renderers of the GL context and outlive this one.
+ */
+template <class... Attrs>
+class renderer {
+public:
+    using buffer_type = draw_buffer<Attrs...>;
+
+    /* Without these the fragment shader can skip the region mapping. */
+    static constexpr bool uses_regions =
+        (std::is_same_v<Attrs, attr::sheet_region> || ...) ||
+        (std::is_same_v<Attrs, attr::slice> || ...) ||
+        (std::is_same_v<Attrs, attr::repeat> || ...);
+
+    /* Returns nothing if the program lacks the glsprite uniforms. */
+    static std::optional<renderer> create(glsprite_render_state &state,
+                                          GLuint prog_id, unsigned screen_w,
+                                          unsigned screen_h)
+    {
+        static constexpr float quad_verts[] = {
+            -1.0f, -1.0f, 0.0f,
+             1.0f, -1.0f, 0.0f,
+            -1.0f,  1.0f, 0.0f,
+             1.0f,  1.0f, 0.0f,
+        };
+        renderer r;
+
+        r.prog_id_ = prog_id;
+        r.state_ = detail::state_ptr(&state, r.vao_.id());
+        r.screen_size_loc_ = glGetUniformLocation(prog_id, "screen_size");
+        r.sheet_size_loc_ = glGetUniformLocation(prog_id, "sheet_size");
+        r.time_loc_ = glGetUniformLocation(prog_id, "time");
+        r.use_regions_loc_ = glGetUniformLocation(prog_id, "use_regions");
+        if (r.screen_size_loc_ < 0 || r.sheet_size_loc_ < 0)
+            return std::nullopt;
+
+        glsprite_render_state_use_program(&state, prog_id);
+        glUniform2f(r.screen_size_loc_, screen_w, screen_h);
+
+        glsprite_render_state_bind_vertex_array(&state, r.vao_.id());
+        glsprite_render_state_bind_array_buffer(&state,
+                                                r.quad_verts_vbo_.id());
+        glBufferData(GL_ARRAY_BUFFER, sizeof(quad_verts), quad_verts,
+                     GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+        glEnableVertexAttribArray(0);
+
+        r.setup_attribs(std::index_sequence_for<Attrs...>());
+
+        return std::optional<renderer>(std::move(r));
+    }
+
+    /* Seconds fed to the animation attribute. */
+    void set_time(float time) { time_ = time; }
+
+    void render(const buffer_type &buf)
+    {
+        const glsprite_sheet &sheet = buf.sheet();
+        glsprite_render_state *state = state_.get();
+
+        glsprite_render_state_use_program(state, prog_id_);
+        glsprite_render_state_bind_texture(state, sheet.texture_id);
+        glsprite_render_state_set_sheet_size(state, prog_id_, sheet_size_loc_,
+                                             sheet.width, sheet.height);
+        glsprite_render_state_set_use_regions(state, prog_id_,
+                                              use_regions_loc_, uses_regions);
+        glsprite_render_state_set_time(state, prog_id_, time_loc_, time_);
+        glsprite_render_state_bind_vertex_array(state, vao_.id());
+
+        upload_attribs(buf, std::index_sequence_for<Attrs...>());
+
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, buf.size());
+    }
+
+    /* Counts the calls avoided by all renderers sharing the state. */
+    unsigned long num_calls_avoided() const
+    {
+        return state_->num_calls_avoided;
+    }
+
+private:
+    renderer() = default;
+
+    template <std::size_t... I>
+    void setup_attribs(std::index_sequence<I...>)
+    {
+        (setup_attrib<Attrs>(I + 1, vbos_[I].id()), ...);
+    }
+
+    template <class A>
+    void setup_attrib(GLuint loc, GLuint vbo_id)
+    {
+        glsprite_render_state_bind_array_buffer(state_.get(), vbo_id);
+        glVertexAttribPointer(loc, A::components, A::gl_type, A::normalized,
+                              0, nullptr);
+        glVertexAttribDivisor(loc, 1);
+        glEnableVertexAttribArray(loc);
+    }
+
+    template <std::size_t... I>
+    void upload_attribs(const buffer_type &buf, std::index_sequence<I...>)
+    {
+        (upload_attrib(buf.template get<Attrs>(), vbos_[I].id()), ...);
+    }
+
+    template <class T>
+    void upload_attrib(const std::vector<T> &arr, GLuint vbo_id)
+    {
+        glsprite_render_state_bind_array_buffer(state_.get(), vbo_id);
+        glBufferData(GL_ARRAY_BUFFER, arr.size() * sizeof(T), arr.data(),
+                     GL_DYNAMIC_DRAW);
+    }
+
+    GLuint prog_id_ = 0;
+    GLint screen_size_loc_ = -1;
+    GLint sheet_size_loc_ = -1;
+    GLint time_loc_ = -1;
+    GLint use_regions_loc_ = -1;
+    float time_ = 0.0f;
+    detail::state_ptr state_;
+    vertex_array vao_;
+    buffer quad_verts_vbo_;
+    std::array<buffer, sizeof...(Attrs)> vbos_;
+};
+
+} /* namespace glsprite */
+
 #endif
@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2019 Aapo Vienamo
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "glsprite.h"
+
+/*
+ * Snapshot file layout, all integers and floats little-endian:
+ *
+ *   struct snapshot_header
+ *   sheet name, NUL terminated
+ *   sheet_offsets, sprite_positions, sprite_dimensions, sprite_origins,
+ *   sprite_angles, sheet_dimensions, sprite_slices and sprite_repeats, each
+ *   starting at a SNAPSHOT_ALIGN aligned file offset
+ *
+ * The arrays have exactly the same layout as the ones in
+ * glsprite_draw_buffer so the mapped file can be used as is. The offset of
+ * the sheet_dimensions, sprite_slices and sprite_repeats arrays is 0 if the
+ * buffer had no region sprites.
+ */
+#define SNAPSHOT_MAGIC "GLSPRSNP"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_ALIGN 64
+
+enum {
+    ARR_SHEET_OFFSETS,
+    ARR_SPRITE_POSITIONS,
+    ARR_SPRITE_DIMENSIONS,
+    ARR_SPRITE_ORIGINS,
+    ARR_SPRITE_ANGLES,
+    ARR_SHEET_DIMENSIONS,
+    ARR_SPRITE_SLICES,
+    ARR_SPRITE_REPEATS,
+    NUM_ARRS,
+};
+
+struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t sheet_width;
+    uint32_t sheet_height;
+    uint32_t sheet_name_len;
+    uint64_t num_sprites;
+    uint64_t arr_offsets[NUM_ARRS];
+};
+
+static const size_t arr_elem_sizes[NUM_ARRS] = {
+    [ARR_SHEET_OFFSETS] = sizeof(struct vec2f),
+    [ARR_SPRITE_POSITIONS] = sizeof(struct vec2f),
+    [ARR_SPRITE_DIMENSIONS] = sizeof(struct vec2f),
+    [ARR_SPRITE_ORIGINS] = sizeof(struct vec2f),
+    [ARR_SPRITE_ANGLES] = sizeof(float),
+    [ARR_SHEET_DIMENSIONS] = sizeof(struct vec2f),
+    [ARR_SPRITE_SLICES] = sizeof(struct glsprite_slice),
+    [ARR_SPRITE_REPEATS] = sizeof(struct vec2f),
+};
+
+static int arr_is_optional(int i)
+{
+    return i >= ARR_SHEET_DIMENSIONS;
+}
+
+static int host_is_little_endian(void)
+{
+    const uint16_t one = 1;
+
+    return *(const uint8_t *)&one == 1;
+}
+
+static uint64_t align_up(uint64_t off)
+{
+    return (off + SNAPSHOT_ALIGN - 1) & ~(uint64_t)(SNAPSHOT_ALIGN - 1);
+}
+
+/* Zero pads the file from *pos up to off and writes sz bytes of data there. */
+static int write_at(FILE *f, uint64_t *pos, uint64_t off, const void *data,
+                    size_t sz)
+{
+    static const char zeros[SNAPSHOT_ALIGN];
+
+    if (fwrite(zeros, 1, off - *pos, f) != off - *pos)
+        return -1;
+
+    if (sz && fwrite(data, 1, sz, f) != sz)
+        return -1;
+
+    *pos = off + sz;
+
+    return 0;
+}
+
+int glsprite_snapshot_write(const char *path,
+                            const struct glsprite_draw_buffer *buf,
+                            const char *sheet_name)
+{
+    const void *arrs[NUM_ARRS] = {
+        [ARR_SHEET_OFFSETS] = buf->sheet_offsets,
+        [ARR_SPRITE_POSITIONS] = buf->sprite_positions,
+        [ARR_SPRITE_DIMENSIONS] = buf->sprite_dimensions,
+        [ARR_SPRITE_ORIGINS] = buf->sprite_origins,
+        [ARR_SPRITE_ANGLES] = buf->sprite_angles,
+        [ARR_SHEET_DIMENSIONS] = buf->sheet_dimensions,
+        [ARR_SPRITE_SLICES] = buf->sprite_slices,
+        [ARR_SPRITE_REPEATS] = buf->sprite_repeats,
+    };
+    struct snapshot_header hdr;
+    size_t name_len = strlen(sheet_name);
+    uint64_t pos = 0;
+    uint64_t off;
+    int err = 0;
+    FILE *f;
+    int i;
+
+    /* The arrays are dumped as is, so only little-endian hosts can do that. */
+    if (!host_is_little_endian())
+        return -1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.sheet_width = buf->sheet->width;
+    hdr.sheet_height = buf->sheet->height;
+    hdr.sheet_name_len = name_len;
+    hdr.num_sprites = buf->num_sprites;
+
+    off = sizeof(hdr) + name_len + 1;
+    for (i = 0; i < NUM_ARRS; ++i) {
+        if (!arrs[i] && arr_is_optional(i))
+            continue;
+
+        off = align_up(off);
+        hdr.arr_offsets[i] = off;
+        off += buf->num_sprites * arr_elem_sizes[i];
+    }
+
+    f = fopen(path, "wb");
+    if (!f)
+        return -1;
+
+    err |= write_at(f, &pos, 0, &hdr, sizeof(hdr));
+    err |= write_at(f, &pos, pos, sheet_name, name_len + 1);
+    for (i = 0; i < NUM_ARRS && !err; ++i) {
+        if (!hdr.arr_offsets[i])
+            continue;
+
+        err |= write_at(f, &pos, hdr.arr_offsets[i], arrs[i],
+                        buf->num_sprites * arr_elem_sizes[i]);
+    }
+
+    if (fclose(f))
+        err = -1;
+
+    return err ? -1 : 0;
+}
+
+int glsprite_snapshot_open(struct glsprite_snapshot *snap, const char *path)
+{
+    const struct snapshot_header *hdr;
+    void *arrs[NUM_ARRS];
+    const char *name;
+    uint64_t data_start;
+    struct stat st;
+    size_t size;
+    uint64_t n;
+    void *map;
+    int err;
+    int fd;
+    int i, j;
+
+    if (!host_is_little_endian())
+        return -1;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+
+    err = fstat(fd, &st);
+    if (err == -1 || (size_t)st.st_size < sizeof(*hdr)) {
+        close(fd);
+        return -1;
+    }
+    size = st.st_size;
+
+    /*
+     * A private writable mapping lets the draw buffer overwrite sprites in
+     * place without the changes ending up in the file.
+     */
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    hdr = map;
+    name = (const char *)map + sizeof(*hdr);
+    n = hdr->num_sprites;
+
+    if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) ||
+        hdr->version != SNAPSHOT_VERSION ||
+        hdr->sheet_name_len >= size - sizeof(*hdr) ||
+        name[hdr->sheet_name_len] != '\0')
+        goto err_unmap;
+
+    data_start = align_up(sizeof(*hdr) + hdr->sheet_name_len + 1);
+
+    for (i = 0; i < NUM_ARRS; ++i) {
+        uint64_t off = hdr->arr_offsets[i];
+
+        if (off == 0 && arr_is_optional(i)) {
+            arrs[i] = NULL;
+            continue;
+        }
+
+        if (off % SNAPSHOT_ALIGN || off < data_start || off > size ||
+            n > (size - off) / arr_elem_sizes[i])
+            goto err_unmap;
+
+        arrs[i] = (char *)map + off;
+    }
+
+    /* The region arrays come as a set. */
+    if (!arrs[ARR_SHEET_DIMENSIONS] != !arrs[ARR_SPRITE_SLICES] ||
+        !arrs[ARR_SHEET_DIMENSIONS] != !arrs[ARR_SPRITE_REPEATS])
+        goto err_unmap;
+
+    /* The arrays are handed out writable, so they must not alias. */
+    for (i = 0; i < NUM_ARRS; ++i) {
+        for (j = i + 1; j < NUM_ARRS; ++j) {
+            uint64_t off_i = hdr->arr_offsets[i];
+            uint64_t off_j = hdr->arr_offsets[j];
+
+            if (!arrs[i] || !arrs[j])
+                continue;
+
+            if (n && off_i < off_j + n * arr_elem_sizes[j] &&
+                off_j < off_i + n * arr_elem_sizes[i])
+                goto err_unmap;
+        }
+    }
+
+    snap->map = map;
+    snap->map_len = size;
+    snap->sheet_name = name;
+    snap->sheet_width = hdr->sheet_width;
+    snap->sheet_height = hdr->sheet_height;
+    snap->num_sprites = n;
+    snap->sheet_offsets = arrs[ARR_SHEET_OFFSETS];
+    snap->sprite_positions = arrs[ARR_SPRITE_POSITIONS];
+    snap->sprite_dimensions = arrs[ARR_SPRITE_DIMENSIONS];
+    snap->sprite_origins = arrs[ARR_SPRITE_ORIGINS];
+    snap->sprite_angles = arrs[ARR_SPRITE_ANGLES];
+    snap->sheet_dimensions = arrs[ARR_SHEET_DIMENSIONS];
+    snap->sprite_slices = arrs[ARR_SPRITE_SLICES];
+    snap->sprite_repeats = arrs[ARR_SPRITE_REPEATS];
+
+    return 0;
+
+err_unmap:
+    munmap(map, size);
+    return -1;
+}
+
+int glsprite_draw_buffer_init_snapshot(struct glsprite_draw_buffer *buf,
+                                       const struct glsprite_sheet *sheet,
+                                       const struct glsprite_snapshot *snap)
+{
+    if (sheet->width != snap->sheet_width ||
+        sheet->height != snap->sheet_height)
+        return -1;
+
+    buf->sheet = sheet;
+    buf->num_sprites = snap->num_sprites;
+    buf->num_allocd = snap->num_sprites;
+    buf->sheet_offsets = snap->sheet_offsets;
+    buf->sprite_positions = snap->sprite_positions;
+    buf->sprite_dimensions = snap->sprite_dimensions;
+    buf->sprite_origins = snap->sprite_origins;
+    buf->sprite_angles = snap->sprite_angles;
+    buf->sheet_dimensions = snap->sheet_dimensions;
+    buf->sprite_slices = snap->sprite_slices;
+    buf->sprite_repeats = snap->sprite_repeats;
+    buf->borrowed = 1;
+
+    return 0;
+}
+
+void glsprite_snapshot_close(struct glsprite_snapshot *snap)
+{
+    munmap(snap->map, snap->map_len);
+    snap->map = NULL;
+    snap->map_len = 0;
+}
@@ -0,0 +1,627 @@
+/*
+ * Copyright (c) 2019 Aapo Vienamo
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GL_GLEXT_PROTOTYPES
+#if defined(__APPLE__)
+#include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+#else
+#include <GL/gl.h>
+#include <GL/glext.h>
+#endif
+
+#include "glsprite.h"
+
+#define BLOCK_DIM 4
+
+/*
+ * Texture file layout, all integers little-endian:
+ *
+ *   magic, version, format, num_levels
+ *   padded grid: sprite width and height, cell width and height, margin
+ *   per level: width, height, size in bytes, then size bytes of data
+ *
+ * The level sizes are 64 bits, everything else is 32 bits. The data is
+ * stored exactly as it is uploaded, so compressed sheets can be built
+ * offline and loaded without touching the texels.
+ */
+#define TEXTURE_MAGIC "GLSPRTEX"
+#define TEXTURE_VERSION 1
+#define TEXTURE_HEADER_LEN (8 + 3 * 4 + 5 * 4)
+#define TEXTURE_LEVEL_HEADER_LEN (2 * 4 + 8)
+
+static unsigned align_up(unsigned v, unsigned align)
+{
+    return (v + align - 1) / align * align;
+}
+
+static unsigned clampu(int v, unsigned max)
+{
+    if (v < 0)
+        return 0;
+    if ((unsigned)v > max)
+        return max;
+    return v;
+}
+
+static size_t level_size(enum glsprite_texture_format format, unsigned w,
+                         unsigned h)
+{
+    size_t num_blocks = (size_t)((w + BLOCK_DIM - 1) / BLOCK_DIM) *
+                        ((h + BLOCK_DIM - 1) / BLOCK_DIM);
+
+    switch (format) {
+    case GLSPRITE_TEXTURE_BC1:
+        return num_blocks * 8;
+    case GLSPRITE_TEXTURE_BC3:
+        return num_blocks * 16;
+    case GLSPRITE_TEXTURE_RGBA8:
+    default:
+        return (size_t)w * h * 4;
+    }
+}
+
+int glsprite_texture_pad(struct glsprite_texture *tex,
+                         struct glsprite_grid *padded_grid,
+                         const unsigned char *rgba, unsigned width,
+                         unsigned height, const struct glsprite_grid *grid,
+                         unsigned num_levels)
+{
+    unsigned sprite_w = grid->sprite_dims.x;
+    unsigned sprite_h = grid->sprite_dims.y;
+    unsigned margin = grid->margin;
+    unsigned cols, rows, gutter, stride_x, stride_y;
+    unsigned x, y;
+    unsigned char *data;
+
+    if (num_levels == 0 || num_levels > GLSPRITE_TEXTURE_MAX_LEVELS ||
+        width < margin + grid->grid_dims.x ||
+        height < margin + grid->grid_dims.y)
+        return -1;
+
+    cols = (width - margin) / (unsigned)grid->grid_dims.x;
+    rows = (height - margin) / (unsigned)grid->grid_dims.y;
+
+    /*
+     * A texel of mip level n covers a 2^n texel square of the base level. With
+     * a gutter that wide around every sprite, no texel of the kept levels
+     * mixes two sprites. A compression block of level n covers BLOCK_DIM << n
+     * base texels, so cells aligned to that for the last level keep blocks
+     * from straddling two sprites on every level.
+     */
+    gutter = 1u << (num_levels - 1);
+    stride_x = align_up(sprite_w + 2 * gutter, BLOCK_DIM << (num_levels - 1));
+    stride_y = align_up(sprite_h + 2 * gutter, BLOCK_DIM << (num_levels - 1));
+
+    data = malloc((size_t)cols * stride_x * rows * stride_y * 4);
+    if (!data)
+        return -1;
+
+    /* The gutters are filled by extruding the sprite edges outwards. */
+    for (y = 0; y < rows * stride_y; ++y) {
+        unsigned cell_y = y / stride_y;
+        unsigned src_y = margin + cell_y * grid->grid_dims.y +
+                         clampu((int)(y % stride_y) - (int)gutter,
+                                sprite_h - 1);
+
+        for (x = 0; x < cols * stride_x; ++x) {
+            unsigned cell_x = x / stride_x;
+            unsigned src_x = margin + cell_x * grid->grid_dims.x +
+                             clampu((int)(x % stride_x) - (int)gutter,
+                                    sprite_w - 1);
+
+            memcpy(data + ((size_t)y * cols * stride_x + x) * 4,
+                   rgba + ((size_t)src_y * width + src_x) * 4, 4);
+        }
+    }
+
+    tex->format = GLSPRITE_TEXTURE_RGBA8;
+    tex->num_levels = 1;
+    tex->levels[0].width = cols * stride_x;
+    tex->levels[0].height = rows * stride_y;
+    tex->levels[0].size = level_size(tex->format, tex->levels[0].width,
+                                     tex->levels[0].height);
+    tex->levels[0].data = data;
+
+    padded_grid->sprite_dims = grid->sprite_dims;
+    padded_grid->grid_dims = vec2f_init(stride_x, stride_y);
+    padded_grid->margin = gutter;
+
+    return 0;
+}
+
+int glsprite_texture_gen_mipmaps(struct glsprite_texture *tex,
+                                 unsigned num_levels)
+{
+    unsigned i, x, y, c;
+
+    /* The levels are derived from the one above, so the base must exist. */
+    if (tex->format != GLSPRITE_TEXTURE_RGBA8 || tex->num_levels == 0 ||
+        num_levels > GLSPRITE_TEXTURE_MAX_LEVELS)
+        return -1;
+
+    for (i = tex->num_levels; i < num_levels; ++i) {
+        const struct glsprite_texture_level *src = &tex->levels[i - 1];
+        struct glsprite_texture_level *dst = &tex->levels[i];
+
+        if (src->width == 1 && src->height == 1)
+            break;
+
+        dst->width = src->width > 1 ? src->width / 2 : 1;
+        dst->height = src->height > 1 ? src->height / 2 : 1;
+        dst->size = level_size(tex->format, dst->width, dst->height);
+        dst->data = malloc(dst->size);
+        if (!dst->data)
+            return -1;
+
+        /* 2x2 box filter, odd edges are clamped. */
+        for (y = 0; y < dst->height; ++y) {
+            unsigned y0 = clampu(2 * y, src->height - 1);
+            unsigned y1 = clampu(2 * y + 1, src->height - 1);
+
+            for (x = 0; x < dst->width; ++x) {
+                unsigned x0 = clampu(2 * x, src->width - 1);
+                unsigned x1 = clampu(2 * x + 1, src->width - 1);
+
+                for (c = 0; c < 4; ++c) {
+                    unsigned sum = src->data[(y0 * src->width + x0) * 4 + c] +
+                                   src->data[(y0 * src->width + x1) * 4 + c] +
+                                   src->data[(y1 * src->width + x0) * 4 + c] +
+                                   src->data[(y1 * src->width + x1) * 4 + c];
+
+                    dst->data[(y * dst->width + x) * 4 + c] = (sum + 2) / 4;
+                }
+            }
+        }
+
+        tex->num_levels = i + 1;
+    }
+
+    return 0;
+}
+
+static uint16_t pack_565(const unsigned char *c)
+{
+    return (c[0] >> 3) << 11 | (c[1] >> 2) << 5 | c[2] >> 3;
+}
+
+static void unpack_565(uint16_t v, int *c)
+{
+    c[0] = ((v >> 11) & 0x1f) * 255 / 0x1f;
+    c[1] = ((v >> 5) & 0x3f) * 255 / 0x3f;
+    c[2] = (v & 0x1f) * 255 / 0x1f;
+}
+
+static void put_le16(unsigned char *out, uint16_t v)
+{
+    out[0] = v;
+    out[1] = v >> 8;
+}
+
+/*
+ * Encodes the color part of a block using the bounding box of the colors as
+ * the endpoints, which is fast and good enough for sprite art.
+ */
+static void encode_color_block(const unsigned char block[16][4],
+                               unsigned char *out)
+{
+    unsigned char lo[3] = { 255, 255, 255 };
+    unsigned char hi[3] = { 0, 0, 0 };
+    int palette[4][3];
+    uint32_t indices = 0;
+    uint16_t c0, c1, tmp;
+    int i, j, c;
+
+    for (i = 0; i < 16; ++i) {
+        for (c = 0; c < 3; ++c) {
+            if (block[i][c] < lo[c])
+                lo[c] = block[i][c];
+            if (block[i][c] > hi[c])
+                hi[c] = block[i][c];
+        }
+    }
+
+    /* Insetting the box slightly reduces the error of the middle colors. */
+    for (c = 0; c < 3; ++c) {
+        int inset = (hi[c] - lo[c]) / 16;
+
+        lo[c] += inset;
+        hi[c] -= inset;
+    }
+
+    c0 = pack_565(hi);
+    c1 = pack_565(lo);
+    if (c0 < c1) {
+        tmp = c0;
+        c0 = c1;
+        c1 = tmp;
+    }
+
+    put_le16(out, c0);
+    put_le16(out + 2, c1);
+
+    /* Equal endpoints select the three color mode, index 0 is still c0. */
+    if (c0 != c1) {
+        unpack_565(c0, palette[0]);
+        unpack_565(c1, palette[1]);
+        for (c = 0; c < 3; ++c) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        for (i = 0; i < 16; ++i) {
+            int best = 0;
+            int best_dist = 0x7fffffff;
+
+            for (j = 0; j < 4; ++j) {
+                int dist = 0;
+
+                for (c = 0; c < 3; ++c) {
+                    int d = block[i][c] - palette[j][c];
+                    dist += d * d;
+                }
+
+                if (dist < best_dist) {
+                    best_dist = dist;
+                    best = j;
+                }
+            }
+
+            indices |= (uint32_t)best << (2 * i);
+        }
+    }
+
+    put_le16(out + 4, indices);
+    put_le16(out + 6, indices >> 16);
+}
+
+static void encode_alpha_block(const unsigned char block[16][4],
+                               unsigned char *out)
+{
+    int a0 = 0, a1 = 255;
+    int palette[8];
+    uint64_t indices = 0;
+    int i, j;
+
+    for (i = 0; i < 16; ++i) {
+        if (block[i][3] > a0)
+            a0 = block[i][3];
+        if (block[i][3] < a1)
+            a1 = block[i][3];
+    }
+
+    out[0] = a0;
+    out[1] = a1;
+
+    /* a0 > a1 selects the eight alpha mode. */
+    if (a0 != a1) {
+        palette[0] = a0;
+        palette[1] = a1;
+        for (j = 1; j < 7; ++j)
+            palette[j + 1] = ((7 - j) * a0 + j * a1) / 7;
+
+        for (i = 0; i < 16; ++i) {
+            int best = 0;
+            int best_dist = 256;
+
+            for (j = 0; j < 8; ++j) {
+                int dist = abs(block[i][3] - palette[j]);
+
+                if (dist < best_dist) {
+                    best_dist = dist;
+                    best = j;
+                }
+            }
+
+            indices |= (uint64_t)best << (3 * i);
+        }
+    }
+
+    for (i = 0; i < 6; ++i)
+        out[2 + i] = indices >> (8 * i);
+}
+
+static void compress_level(enum glsprite_texture_format format,
+                           const struct glsprite_texture_level *src,
+                           unsigned char *out)
+{
+    unsigned char block[16][4];
+    unsigned bx, by, x, y;
+
+    for (by = 0; by < src->height; by += BLOCK_DIM) {
+        for (bx = 0; bx < src->width; bx += BLOCK_DIM) {
+            /* Blocks hanging over the edge repeat the last texels. */
+            for (y = 0; y < BLOCK_DIM; ++y) {
+                for (x = 0; x < BLOCK_DIM; ++x) {
+                    unsigned sx = clampu(bx + x, src->width - 1);
+                    unsigned sy = clampu(by + y, src->height - 1);
+
+                    memcpy(block[y * BLOCK_DIM + x],
+                           src->data + (sy * src->width + sx) * 4, 4);
+                }
+            }
+
+            if (format == GLSPRITE_TEXTURE_BC3) {
+                encode_alpha_block(block, out);
+                out += 8;
+            }
+
+            encode_color_block(block, out);
+            out += 8;
+        }
+    }
+}
+
+int glsprite_texture_compress(struct glsprite_texture *tex,
+                              enum glsprite_texture_format format)
+{
+    unsigned char *data[GLSPRITE_TEXTURE_MAX_LEVELS];
+    struct glsprite_texture_level *level;
+    unsigned i;
+
+    if (tex->format != GLSPRITE_TEXTURE_RGBA8)
+        return -1;
+
+    if (format == GLSPRITE_TEXTURE_RGBA8)
+        return 0;
+
+    for (i = 0; i < tex->num_levels; ++i) {
+        level = &tex->levels[i];
+        data[i] = malloc(level_size(format, level->width, level->height));
+        if (!data[i]) {
+            while (i--)
+                free(data[i]);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < tex->num_levels; ++i) {
+        level = &tex->levels[i];
+
+        compress_level(format, level, data[i]);
+
+        free(level->data);
+        level->data = data[i];
+        level->size = level_size(format, level->width, level->height);
+    }
+
+    tex->format = format;
+
+    return 0;
+}
+
+int glsprite_texture_format_supported(enum glsprite_texture_format format)
+{
+    GLint num_exts = 0;
+    GLint i;
+
+    if (format == GLSPRITE_TEXTURE_RGBA8)
+        return 1;
+
+    glGetIntegerv(GL_NUM_EXTENSIONS, &num_exts);
+    for (i = 0; i < num_exts; ++i) {
+        const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+
+        if (!strcmp(ext, "GL_EXT_texture_compression_s3tc"))
+            return 1;
+    }
+
+    return 0;
+}
+
+int glsprite_sheet_init_texture(struct glsprite_sheet *sheet,
+                                const struct glsprite_texture *tex)
+{
+    GLenum internal_format;
+    GLint prev_texture_id;
+    GLuint texture_id;
+    size_t vram_bytes = 0;
+    unsigned i;
+
+    switch (tex->format) {
+    case GLSPRITE_TEXTURE_BC1:
+        internal_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        break;
+    case GLSPRITE_TEXTURE_BC3:
+        internal_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        break;
+    case GLSPRITE_TEXTURE_RGBA8:
+    default:
+        internal_format = GL_RGBA8;
+        break;
+    }
+
+    /* Keeps the binding shadowed by glsprite_renderer intact. */
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &prev_texture_id);
+
+    glGenTextures(1, &texture_id);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+
+    for (i = 0; i < tex->num_levels; ++i) {
+        const struct glsprite_texture_level *level = &tex->levels[i];
+
+        if (tex->format == GLSPRITE_TEXTURE_RGBA8)
+            glTexImage2D(GL_TEXTURE_2D, i, internal_format, level->width,
+                         level->height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                         level->data);
+        else
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, internal_format,
+                                   level->width, level->height, 0,
+                                   level->size, level->data);
+
+        if (glGetError() != GL_NO_ERROR)
+            break;
+
+        vram_bytes += level->size;
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, tex->num_levels - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                    tex->num_levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glBindTexture(GL_TEXTURE_2D, prev_texture_id);
+
+    if (i < tex->num_levels || glGetError() != GL_NO_ERROR) {
+        glDeleteTextures(1, &texture_id);
+        return -1;
+    }
+
+    glsprite_sheet_init(sheet, texture_id, tex->levels[0].width,
+                        tex->levels[0].height);
+    sheet->vram_bytes = vram_bytes;
+
+    return 0;
+}
+
+static void put_le32(unsigned char *out, uint32_t v)
+{
+    int i;
+
+    for (i = 0; i < 4; ++i)
+        out[i] = v >> (8 * i);
+}
+
+static uint32_t get_le32(const unsigned char *in)
+{
+    return (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 |
+           (uint32_t)in[3] << 24;
+}
+
+int glsprite_texture_write(const char *path,
+                           const struct glsprite_texture *tex,
+                           const struct glsprite_grid *grid)
+{
+    unsigned char hdr[TEXTURE_HEADER_LEN];
+    unsigned char level_hdr[TEXTURE_LEVEL_HEADER_LEN];
+    int err = 0;
+    unsigned i;
+    FILE *f;
+
+    memcpy(hdr, TEXTURE_MAGIC, 8);
+    put_le32(hdr + 8, TEXTURE_VERSION);
+    put_le32(hdr + 12, tex->format);
+    put_le32(hdr + 16, tex->num_levels);
+    put_le32(hdr + 20, grid->sprite_dims.x);
+    put_le32(hdr + 24, grid->sprite_dims.y);
+    put_le32(hdr + 28, grid->grid_dims.x);
+    put_le32(hdr + 32, grid->grid_dims.y);
+    put_le32(hdr + 36, grid->margin);
+
+    f = fopen(path, "wb");
+    if (!f)
+        return -1;
+
+    if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr))
+        err = -1;
+
+    for (i = 0; i < tex->num_levels && !err; ++i) {
+        const struct glsprite_texture_level *level = &tex->levels[i];
+
+        put_le32(level_hdr, level->width);
+        put_le32(level_hdr + 4, level->height);
+        put_le32(level_hdr + 8, (uint64_t)level->size);
+        put_le32(level_hdr + 12, (uint64_t)level->size >> 32);
+
+        if (fwrite(level_hdr, 1, sizeof(level_hdr), f) != sizeof(level_hdr) ||
+            fwrite(level->data, 1, level->size, f) != level->size)
+            err = -1;
+    }
+
+    if (fclose(f))
+        err = -1;
+
+    return err;
+}
+
+int glsprite_texture_load(struct glsprite_texture *tex,
+                          struct glsprite_grid *grid, const char *path)
+{
+    unsigned char hdr[TEXTURE_HEADER_LEN];
+    unsigned char level_hdr[TEXTURE_LEVEL_HEADER_LEN];
+    enum glsprite_texture_format format;
+    unsigned num_levels;
+    unsigned i;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (!f)
+        return -1;
+
+    if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr))
+        goto err_close;
+
+    format = get_le32(hdr + 12);
+    num_levels = get_le32(hdr + 16);
+
+    if (memcmp(hdr, TEXTURE_MAGIC, 8) ||
+        get_le32(hdr + 8) != TEXTURE_VERSION ||
+        (format != GLSPRITE_TEXTURE_RGBA8 && format != GLSPRITE_TEXTURE_BC1 &&
+         format != GLSPRITE_TEXTURE_BC3) ||
+        num_levels == 0 || num_levels > GLSPRITE_TEXTURE_MAX_LEVELS)
+        goto err_close;
+
+    tex->format = format;
+    tex->num_levels = 0;
+
+    for (i = 0; i < num_levels; ++i) {
+        struct glsprite_texture_level *level = &tex->levels[i];
+        uint64_t size;
+
+        if (fread(level_hdr, 1, sizeof(level_hdr), f) != sizeof(level_hdr))
+            goto err_destroy;
+
+        level->width = get_le32(level_hdr);
+        level->height = get_le32(level_hdr + 4);
+        size = get_le32(level_hdr + 8) |
+               (uint64_t)get_le32(level_hdr + 12) << 32;
+
+        /* Also rules out sizes that overflowed when they were computed. */
+        if (level->width == 0 || level->height == 0 ||
+            level->width > 1u << 16 || level->height > 1u << 16 ||
+            size != level_size(format, level->width, level->height))
+            goto err_destroy;
+
+        level->size = size;
+        level->data = malloc(level->size);
+        if (!level->data)
+            goto err_destroy;
+        tex->num_levels = i + 1;
+
+        if (fread(level->data, 1, level->size, f) != level->size)
+            goto err_destroy;
+    }
+
+    fclose(f);
+
+    grid->sprite_dims = vec2f_init(get_le32(hdr + 20), get_le32(hdr + 24));
+    grid->grid_dims = vec2f_init(get_le32(hdr + 28), get_le32(hdr + 32));
+    grid->margin = get_le32(hdr + 36);
+
+    return 0;
+
+err_destroy:
+    glsprite_texture_destroy(tex);
+err_close:
+    fclose(f);
+    return -1;
+}
+
+void glsprite_texture_destroy(struct glsprite_texture *tex)
+{
+    unsigned i;
+
+    for (i = 0; i < tex->num_levels; ++i)
+        free(tex->levels[i].data);
+
+    tex->num_levels = 0;
+}
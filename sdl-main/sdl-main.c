@@ -6,7 +6,9 @@
 #include <assert.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include <GL/glew.h>
 #include <SDL2/SDL.h>
@@ -21,6 +23,12 @@
 
 #define DEG2RAD(deg) (((deg) / 180.0f) * M_PI)
 
+#define SHEET_PATH "spritesheet.png"
+#define SHEET_SPRITE_SIZE 21
+#define SHEET_MARGIN 2
+#define SHEET_MIP_LEVELS 4
+#define SHEET_CACHE_PATH "spritesheet.tex"
+
 static struct vec2f sprite_positions[] = {
     VEC2F_INIT(100, 100),
     VEC2F_INIT(500, 300),
@@ -42,6 +50,69 @@ static struct vec2f sprite_origins[] = {
     VEC2F_INIT(10, 10),
 };
 
+/*
+ * The cache is stale if the sheet has been modified since it was written or
+ * if it was built with different settings. The timestamps only have a
+ * resolution of a second, so a cache written during the same second as the
+ * sheet counts as up to date.
+ */
+static bool sheet_cache_valid(const struct glsprite_texture *tex,
+                              const struct glsprite_grid *grid)
+{
+    struct stat sheet_st, cache_st;
+
+    if (stat(SHEET_PATH, &sheet_st) || stat(SHEET_CACHE_PATH, &cache_st) ||
+        cache_st.st_mtime < sheet_st.st_mtime)
+        return false;
+
+    return tex->num_levels == SHEET_MIP_LEVELS &&
+           grid->sprite_dims.x == SHEET_SPRITE_SIZE &&
+           grid->sprite_dims.y == SHEET_SPRITE_SIZE &&
+           glsprite_texture_format_supported(tex->format);
+}
+
+/*
+ * Padding, mipmapping and compressing the sheet is only done when there is no
+ * usable cached copy of the result.
+ */
+static void load_sheet_texture(struct glsprite_texture *tex,
+                               struct glsprite_grid *grid)
+{
+    int sprite_sheet_w, sprite_sheet_h, sprite_sheet_num_channels;
+    unsigned char *sprite_sheet_data;
+    struct glsprite_grid sheet_grid;
+    int err;
+
+    if (glsprite_texture_load(tex, grid, SHEET_CACHE_PATH) == 0) {
+        if (sheet_cache_valid(tex, grid))
+            return;
+        glsprite_texture_destroy(tex);
+    }
+
+    sprite_sheet_data = stbi_load(SHEET_PATH, &sprite_sheet_w,
+                                  &sprite_sheet_h, &sprite_sheet_num_channels,
+                                  4);
+    assert(sprite_sheet_data);
+
+    glsprite_grid_init(&sheet_grid, SHEET_SPRITE_SIZE, SHEET_SPRITE_SIZE,
+                       SHEET_MARGIN);
+    err = glsprite_texture_pad(tex, grid, sprite_sheet_data, sprite_sheet_w,
+                               sprite_sheet_h, &sheet_grid, SHEET_MIP_LEVELS);
+    assert(err == 0);
+    stbi_image_free(sprite_sheet_data);
+
+    err = glsprite_texture_gen_mipmaps(tex, SHEET_MIP_LEVELS);
+    assert(err == 0);
+
+    if (glsprite_texture_format_supported(GLSPRITE_TEXTURE_BC1)) {
+        err = glsprite_texture_compress(tex, GLSPRITE_TEXTURE_BC1);
+        assert(err == 0);
+    }
+
+    if (glsprite_texture_write(SHEET_CACHE_PATH, tex, grid))
+        fprintf(stderr, "Failed to write %s\n", SHEET_CACHE_PATH);
+}
+
 int main(void)
 {
     SDL_Window *win;
@@ -49,20 +120,19 @@ int main(void)
     SDL_Event ev;
     bool running = true;
 
+    struct glsprite_render_state render_state;
     struct glsprite_renderer renderer;
     struct glsprite_sheet sheet;
+    struct glsprite_texture sheet_tex;
     struct glsprite_grid grid;
     struct glsprite_draw_buffer draw_buffer;
 
-    int sprite_sheet_w, sprite_sheet_h, sprite_sheet_num_channels;
-    unsigned char *sprite_sheet_data;
     int err;
     int i;
 
     GLuint fs_id;
     GLuint vs_id;
     GLuint prog_id;
-    GLuint sprite_sheet_tex_id;
 
     SDL_Init(SDL_INIT_VIDEO);
 
@@ -78,22 +148,20 @@ int main(void)
 
     glewExperimental = GL_TRUE;
     glewInit();
+    /* GLEW can leave a GL_INVALID_ENUM behind on core profiles. */
+    glGetError();
 
     SDL_GL_SetSwapInterval(1);
 
     glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
 
-    sprite_sheet_data = stbi_load("spritesheet.png", &sprite_sheet_w,
-                                  &sprite_sheet_h, &sprite_sheet_num_channels,
-                                  0);
+    load_sheet_texture(&sheet_tex, &grid);
+
+    err = glsprite_sheet_init_texture(&sheet, &sheet_tex);
+    assert(err == 0);
+    glsprite_texture_destroy(&sheet_tex);
 
-    glGenTextures(1, &sprite_sheet_tex_id);
-    glBindTexture(GL_TEXTURE_2D, sprite_sheet_tex_id);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, sprite_sheet_w, sprite_sheet_h, 0,
-                 GL_RGB, GL_UNSIGNED_BYTE, sprite_sheet_data);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    printf("Sprite sheet uses %zu bytes of VRAM\n", sheet.vram_bytes);
 
     fs_id = glutil_compile_shader_file("../shader/fs.glsl", GL_FRAGMENT_SHADER);
     assert(fs_id);
@@ -102,13 +170,10 @@ int main(void)
     prog_id = glutil_link_shaders(glCreateProgram(), fs_id, vs_id);
     assert(prog_id);
 
-    err = glsprite_renderer_init(&renderer, prog_id, 640, 480);
+    glsprite_render_state_init(&render_state);
+    err = glsprite_renderer_init(&renderer, &render_state, prog_id, 640, 480);
     assert(err == 0);
 
-    glsprite_sheet_init(&sheet, sprite_sheet_tex_id, sprite_sheet_w,
-                        sprite_sheet_h);
-    glsprite_grid_init(&grid, 21, 21, 2);
-
     glsprite_draw_buffer_init(&draw_buffer, &sheet);
 
     while (running) {
@@ -135,6 +200,8 @@ int main(void)
     }
 
     glsprite_draw_buffer_destroy(&draw_buffer);
+    glsprite_sheet_destroy(&sheet, &render_state);
+    glsprite_renderer_destroy(&renderer);
 
     SDL_GL_DeleteContext(gl_ctx);
     SDL_DestroyWindow(win);
@@ -1,12 +1,50 @@
 #version 330 core
 
 uniform sampler2D sprite_sheet;
+uniform vec2 sheet_size;
+uniform bool use_regions = true;
 
-in vec2 tex_coords;
+in vec2 sprite_coords;
+flat in vec2 dest_size;
+flat in vec2 region_offset;
+flat in vec2 region_size;
+flat in vec4 region_slice;
+flat in vec2 region_repeat;
+flat in vec4 tint;
 
 out vec4 fragColor;
 
 void main()
 {
-    fragColor = texture(sprite_sheet, tex_coords);
+    /* Plain sprites map one to one and need no slicing or wrapping. */
+    if (!use_regions) {
+        fragColor = texture(sprite_sheet,
+                            (region_offset + sprite_coords) / sheet_size) *
+                    tint;
+        return;
+    }
+
+    vec2 lo = region_slice.xy;
+    vec2 hi = region_slice.zw;
+    vec2 mid_dest = max(dest_size - lo - hi, vec2(1e-4));
+    vec2 mid_src = region_size - lo - hi;
+    bvec2 in_lo = lessThan(sprite_coords, lo);
+    bvec2 in_hi = greaterThan(sprite_coords, dest_size - hi);
+
+    /*
+     * The borders map one to one, the center is stretched over its area
+     * region_repeat times and wrapped back into the atlas cell.
+     */
+    vec2 t = (sprite_coords - lo) / mid_dest * region_repeat;
+    vec2 src = lo + fract(t) * mid_src;
+    src = mix(src, sprite_coords, in_lo);
+    src = mix(src, region_size - (dest_size - sprite_coords), in_hi);
+
+    /* The wrap is discontinuous, so derive the mip level from the scale. */
+    vec2 scale = mix(mid_src * region_repeat / mid_dest, vec2(1.0),
+                     bvec2(in_lo.x || in_hi.x, in_lo.y || in_hi.y));
+
+    fragColor = textureGrad(sprite_sheet, (region_offset + src) / sheet_size,
+                            dFdx(sprite_coords) * scale / sheet_size,
+                            dFdy(sprite_coords) * scale / sheet_size) * tint;
 }
@@ -2,15 +2,36 @@
 
 uniform vec2 screen_size;
 uniform vec2 sheet_size;
+uniform float time;
+/* Cleared for draw buffers without region sprites, see fs.glsl. */
+uniform bool use_regions = true;
 
+/*
+ * The C++ front-end generates these from the instance attribute list of its
+ * draw buffer and defines GLSPRITE_ATTRIBS.
+ */
+#ifndef GLSPRITE_ATTRIBS
 layout(location = 0) in vec3 quad_vert_pos;
 layout(location = 1) in vec2 sprite_pos;
 layout(location = 2) in vec2 sprite_size;
 layout(location = 3) in float sprite_rot;
 layout(location = 4) in vec2 sheet_offset;
 layout(location = 5) in vec2 sprite_origin;
+layout(location = 6) in vec2 sheet_region_size;
+layout(location = 7) in vec4 sprite_slice;
+layout(location = 8) in vec2 sprite_repeat;
+const vec4 sprite_tint = vec4(1.0);
+const float sprite_layer = 0.0;
+const vec4 sprite_anim = vec4(0.0, 0.0, 1.0, 0.0);
+#endif
 
-out vec2 tex_coords;
+out vec2 sprite_coords;
+flat out vec2 dest_size;
+flat out vec2 region_offset;
+flat out vec2 region_size;
+flat out vec4 region_slice;
+flat out vec2 region_repeat;
+flat out vec4 tint;
 
 void main() {
     mat2 rot = mat2(cos(sprite_rot), sin(sprite_rot),
@@ -19,10 +40,31 @@ void main() {
                  2.0f * sprite_origin) * rot / screen_size;
     vec2 sp = sprite_pos / (screen_size * 0.5f) - 1.0f;
 
-    gl_Position = vec4(qvp + sp, quad_vert_pos.z, 1.0f);
-    gl_Position.y *= -1.0f;
+    /* sprite_anim holds the frame stride, frame count and frame rate. */
+    float frame = mod(floor(time * sprite_anim.w), sprite_anim.z);
+
+    /*
+     * Higher layers get a smaller depth. The mapping stays inside (-1, 1), so
+     * no layer gets clipped, and keeps integral layers up to about 2000
+     * apart in a 24-bit depth buffer. They only sort with GL_DEPTH_TEST and
+     * GL_LESS or GL_LEQUAL enabled, otherwise draw order decides.
+     */
+    float depth = -sprite_layer / (1.0 + abs(sprite_layer));
 
-    tex_coords = (sprite_size * (quad_vert_pos.xy * 0.5 + 0.5) + sheet_offset) /
-                 sheet_size;
+    gl_Position = vec4(qvp + sp, quad_vert_pos.z + depth, 1.0f);
+    gl_Position.y *= -1.0f;
 
+    sprite_coords = sprite_size * (quad_vert_pos.xy * 0.5 + 0.5);
+    dest_size = sprite_size;
+    region_offset = sheet_offset + sprite_anim.xy * frame;
+    if (use_regions) {
+        region_size = sheet_region_size;
+        region_slice = sprite_slice;
+        region_repeat = sprite_repeat;
+    } else {
+        region_size = sprite_size;
+        region_slice = vec4(0.0);
+        region_repeat = vec2(1.0);
+    }
+    tint = sprite_tint;
 }
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2019 Aapo Vienamo
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+
+#define GL_GLEXT_PROTOTYPES
+#include "glshim.h"
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof(a[0]))
+
+enum {
+    UNIFORM_LOC_SCREEN_SIZE,
+    UNIFORM_LOC_SHEET_SIZE,
+    UNIFORM_LOC_USE_REGIONS,
+    UNIFORM_LOC_TIME,
+};
+
+#define MAX_ATTRIBS 16
+
+unsigned glshim_calls[GLSHIM_NUM_CALLS];
+struct glshim_draw glshim_last_draw;
+
+static GLuint next_vao_id = 1;
+static GLuint next_buffer_id = 1;
+static GLuint next_texture_id = 1;
+static GLuint cur_prog_id;
+static GLuint cur_vao_id;
+static GLuint cur_texture_id;
+/* Uniforms are per program state. */
+static GLfloat sheet_sizes[GLSHIM_MAX_OBJECTS][2];
+static GLint use_regions[GLSHIM_MAX_OBJECTS];
+static GLfloat times[GLSHIM_MAX_OBJECTS];
+static int enabled_arrays[GLSHIM_MAX_OBJECTS][MAX_ATTRIBS];
+
+void glshim_reset_calls(void)
+{
+    memset(glshim_calls, 0, sizeof(glshim_calls));
+}
+
+unsigned glshim_total_calls(void)
+{
+    unsigned total = 0;
+    size_t i;
+
+    for (i = 0; i < ARRAY_LEN(glshim_calls); ++i)
+        total += glshim_calls[i];
+
+    return total;
+}
+
+void glUseProgram(GLuint program)
+{
+    ++glshim_calls[GLSHIM_USE_PROGRAM];
+    cur_prog_id = program;
+}
+
+GLint glGetUniformLocation(GLuint program, const GLchar *name)
+{
+    (void)program;
+
+    if (!strcmp(name, "screen_size"))
+        return UNIFORM_LOC_SCREEN_SIZE;
+    if (!strcmp(name, "sheet_size"))
+        return UNIFORM_LOC_SHEET_SIZE;
+    if (!strcmp(name, "use_regions"))
+        return UNIFORM_LOC_USE_REGIONS;
+    if (!strcmp(name, "time"))
+        return UNIFORM_LOC_TIME;
+
+    return -1;
+}
+
+void glUniform2f(GLint location, GLfloat v0, GLfloat v1)
+{
+    ++glshim_calls[GLSHIM_UNIFORM];
+
+    if (location == UNIFORM_LOC_SHEET_SIZE) {
+        sheet_sizes[cur_prog_id][0] = v0;
+        sheet_sizes[cur_prog_id][1] = v1;
+    }
+}
+
+void glUniform1f(GLint location, GLfloat v0)
+{
+    ++glshim_calls[GLSHIM_UNIFORM];
+
+    if (location == UNIFORM_LOC_TIME)
+        times[cur_prog_id] = v0;
+}
+
+void glUniform1i(GLint location, GLint v0)
+{
+    ++glshim_calls[GLSHIM_UNIFORM];
+
+    if (location == UNIFORM_LOC_USE_REGIONS)
+        use_regions[cur_prog_id] = v0;
+}
+
+void glGenVertexArrays(GLsizei n, GLuint *arrays)
+{
+    while (n--)
+        *arrays++ = next_vao_id++;
+}
+
+void glBindVertexArray(GLuint array)
+{
+    ++glshim_calls[GLSHIM_BIND_VERTEX_ARRAY];
+    cur_vao_id = array;
+}
+
+void glDeleteVertexArrays(GLsizei n, const GLuint *arrays)
+{
+    while (n--)
+        if (*arrays++ == cur_vao_id)
+            cur_vao_id = 0;
+}
+
+void glGenBuffers(GLsizei n, GLuint *buffers)
+{
+    while (n--)
+        *buffers++ = next_buffer_id++;
+}
+
+void glBindBuffer(GLenum target, GLuint buffer)
+{
+    (void)target;
+    (void)buffer;
+
+    ++glshim_calls[GLSHIM_BIND_BUFFER];
+}
+
+void glBufferData(GLenum target, GLsizeiptr size, const void *data,
+                  GLenum usage)
+{
+    (void)target;
+    (void)size;
+    (void)data;
+    (void)usage;
+
+    ++glshim_calls[GLSHIM_BUFFER_DATA];
+}
+
+void glDeleteBuffers(GLsizei n, const GLuint *buffers)
+{
+    (void)n;
+    (void)buffers;
+}
+
+void glVertexAttribPointer(GLuint index, GLint size, GLenum type,
+                           GLboolean normalized, GLsizei stride,
+                           const void *pointer)
+{
+    (void)index;
+    (void)size;
+    (void)type;
+    (void)normalized;
+    (void)stride;
+    (void)pointer;
+}
+
+void glVertexAttribDivisor(GLuint index, GLuint divisor)
+{
+    (void)index;
+    (void)divisor;
+}
+
+void glEnableVertexAttribArray(GLuint index)
+{
+    ++glshim_calls[GLSHIM_ENABLE_ARRAY];
+    enabled_arrays[cur_vao_id][index] = 1;
+}
+
+void glDisableVertexAttribArray(GLuint index)
+{
+    ++glshim_calls[GLSHIM_ENABLE_ARRAY];
+    enabled_arrays[cur_vao_id][index] = 0;
+}
+
+void glBindTexture(GLenum target, GLuint texture)
+{
+    (void)target;
+
+    ++glshim_calls[GLSHIM_BIND_TEXTURE];
+    cur_texture_id = texture;
+}
+
+void glGenTextures(GLsizei n, GLuint *textures)
+{
+    while (n--)
+        *textures++ = next_texture_id++;
+}
+
+void glTexImage2D(GLenum target, GLint level, GLint internalformat,
+                  GLsizei width, GLsizei height, GLint border, GLenum format,
+                  GLenum type, const void *pixels)
+{
+    (void)target;
+    (void)level;
+    (void)internalformat;
+    (void)width;
+    (void)height;
+    (void)border;
+    (void)format;
+    (void)type;
+    (void)pixels;
+}
+
+void glCompressedTexImage2D(GLenum target, GLint level,
+                            GLenum internalformat, GLsizei width,
+                            GLsizei height, GLint border, GLsizei imageSize,
+                            const void *data)
+{
+    (void)target;
+    (void)level;
+    (void)internalformat;
+    (void)width;
+    (void)height;
+    (void)border;
+    (void)imageSize;
+    (void)data;
+}
+
+void glTexParameteri(GLenum target, GLenum pname, GLint param)
+{
+    (void)target;
+    (void)pname;
+    (void)param;
+}
+
+/* No extensions and nothing bound, which is all glsprite queries. */
+void glGetIntegerv(GLenum pname, GLint *data)
+{
+    (void)pname;
+
+    *data = 0;
+}
+
+const GLubyte *glGetStringi(GLenum name, GLuint index)
+{
+    (void)name;
+    (void)index;
+
+    return (const GLubyte *)"";
+}
+
+GLenum glGetError(void)
+{
+    return GL_NO_ERROR;
+}
+
+void glDeleteTextures(GLsizei n, const GLuint *textures)
+{
+    while (n--)
+        if (*textures++ == cur_texture_id)
+            cur_texture_id = 0;
+}
+
+void glDrawArraysInstanced(GLenum mode, GLint first, GLsizei count,
+                           GLsizei instancecount)
+{
+    size_t i;
+
+    (void)mode;
+    (void)first;
+    (void)count;
+
+    ++glshim_calls[GLSHIM_DRAW];
+    glshim_last_draw.prog_id = cur_prog_id;
+    glshim_last_draw.vao_id = cur_vao_id;
+    glshim_last_draw.texture_id = cur_texture_id;
+    glshim_last_draw.sheet_width = sheet_sizes[cur_prog_id][0];
+    glshim_last_draw.sheet_height = sheet_sizes[cur_prog_id][1];
+    glshim_last_draw.use_regions = use_regions[cur_prog_id];
+    glshim_last_draw.time = times[cur_prog_id];
+    glshim_last_draw.num_instances = instancecount;
+    glshim_last_draw.num_enabled_arrays = 0;
+    for (i = 0; i < ARRAY_LEN(enabled_arrays[0]); ++i)
+        glshim_last_draw.num_enabled_arrays += enabled_arrays[cur_vao_id][i];
+}
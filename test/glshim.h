@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2019 Aapo Vienamo
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef GLSHIM_H
+#define GLSHIM_H
+
+#if defined(__APPLE__)
+#include <OpenGL/gl.h>
+#else
+#include <GL/gl.h>
+#endif
+
+/*
+ * Stand-in for the GL entry points used by glsprite. It counts the state
+ * changing calls and tracks the bindings like a single context would, so
+ * tests can check both how many calls were made and what a draw used.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GLSHIM_MAX_OBJECTS 32
+
+enum glshim_call {
+    GLSHIM_USE_PROGRAM,
+    GLSHIM_BIND_VERTEX_ARRAY,
+    GLSHIM_BIND_BUFFER,
+    GLSHIM_BIND_TEXTURE,
+    GLSHIM_UNIFORM,
+    GLSHIM_BUFFER_DATA,
+    GLSHIM_ENABLE_ARRAY,
+    GLSHIM_DRAW,
+    GLSHIM_NUM_CALLS,
+};
+
+struct glshim_draw {
+    GLuint prog_id;
+    GLuint vao_id;
+    GLuint texture_id;
+    GLfloat sheet_width;
+    GLfloat sheet_height;
+    GLint use_regions;
+    GLfloat time;
+    unsigned num_enabled_arrays;
+    GLsizei num_instances;
+};
+
+extern unsigned glshim_calls[GLSHIM_NUM_CALLS];
+extern struct glshim_draw glshim_last_draw;
+
+void glshim_reset_calls(void);
+
+unsigned glshim_total_calls(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
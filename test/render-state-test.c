@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2019 Aapo Vienamo
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Checks that glsprite_render_draw_buffer skips exactly the redundant GL
+ * calls and that renderers sharing a context rebind their own state.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "glsprite.h"
+#include "glshim.h"
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,     \
+                    __LINE__, #cond);                                   \
+            ++num_failures;                                             \
+        }                                                               \
+    } while (0)
+
+/* Per-instance arrays uploaded for every draw and for region sprites. */
+#define NUM_PLAIN_UPLOADS 5
+#define NUM_REGION_UPLOADS 3
+
+static int num_failures;
+
+static void push_sprites(struct glsprite_draw_buffer *buf, int n)
+{
+    int i;
+
+    for (i = 0; i < n; ++i)
+        glsprite_draw_buffer_push(buf, vec2f_init(0.0f, 0.0f),
+                                  vec2f_init(i, i), vec2f_init(8.0f, 8.0f),
+                                  vec2f_init(0.0f, 0.0f), 0.0f);
+}
+
+static void check_draw(const struct glsprite_renderer *rend,
+                       const struct glsprite_draw_buffer *buf)
+{
+    int regions = buf->sprite_slices != NULL;
+
+    CHECK(glshim_last_draw.prog_id == rend->prog_id);
+    CHECK(glshim_last_draw.vao_id == rend->vao_id);
+    CHECK(glshim_last_draw.texture_id == buf->sheet->texture_id);
+    CHECK(glshim_last_draw.sheet_width == buf->sheet->width);
+    CHECK(glshim_last_draw.sheet_height == buf->sheet->height);
+    CHECK(glshim_last_draw.num_instances == (GLsizei)buf->num_sprites);
+    CHECK(glshim_last_draw.use_regions == regions);
+    CHECK(glshim_last_draw.num_enabled_arrays ==
+          1 + NUM_PLAIN_UPLOADS + regions * NUM_REGION_UPLOADS);
+}
+
+static void test_same_buffer_twice(void)
+{
+    struct glsprite_render_state state;
+    struct glsprite_renderer rend;
+    struct glsprite_draw_buffer buf;
+    struct glsprite_sheet sheet;
+    unsigned long avoided;
+
+    glsprite_render_state_init(&state);
+    CHECK(glsprite_renderer_init(&rend, &state, 1, 640, 480) == 0);
+    glsprite_sheet_init(&sheet, 10, 64, 64);
+    glsprite_draw_buffer_init(&buf, &sheet);
+    push_sprites(&buf, 3);
+
+    /* The program and vertex array are still bound from the init. */
+    glshim_reset_calls();
+    avoided = state.num_calls_avoided;
+    glsprite_render_draw_buffer(&rend, &buf);
+    CHECK(glshim_calls[GLSHIM_USE_PROGRAM] == 0);
+    CHECK(glshim_calls[GLSHIM_BIND_VERTEX_ARRAY] == 0);
+    CHECK(glshim_calls[GLSHIM_BIND_TEXTURE] == 1);
+    CHECK(glshim_calls[GLSHIM_UNIFORM] == 2);
+    CHECK(glshim_calls[GLSHIM_BIND_BUFFER] == NUM_PLAIN_UPLOADS);
+    CHECK(glshim_calls[GLSHIM_BUFFER_DATA] == NUM_PLAIN_UPLOADS);
+    CHECK(glshim_calls[GLSHIM_ENABLE_ARRAY] == 0);
+    CHECK(glshim_calls[GLSHIM_DRAW] == 1);
+    CHECK(state.num_calls_avoided - avoided == 2);
+    check_draw(&rend, &buf);
+
+    glshim_reset_calls();
+    avoided = state.num_calls_avoided;
+    glsprite_render_draw_buffer(&rend, &buf);
+    CHECK(glshim_calls[GLSHIM_USE_PROGRAM] == 0);
+    CHECK(glshim_calls[GLSHIM_BIND_VERTEX_ARRAY] == 0);
+    CHECK(glshim_calls[GLSHIM_BIND_TEXTURE] == 0);
+    CHECK(glshim_calls[GLSHIM_UNIFORM] == 0);
+    CHECK(glshim_calls[GLSHIM_BIND_BUFFER] == NUM_PLAIN_UPLOADS);
+    CHECK(glshim_calls[GLSHIM_BUFFER_DATA] == NUM_PLAIN_UPLOADS);
+    CHECK(glshim_calls[GLSHIM_DRAW] == 1);
+    CHECK(glshim_total_calls() == 2 * NUM_PLAIN_UPLOADS + 1);
+    CHECK(state.num_calls_avoided - avoided == 5);
+    check_draw(&rend, &buf);
+
+    glsprite_draw_buffer_destroy(&buf);
+    glsprite_renderer_destroy(&rend);
+}
+
+/* Renders a, b and then a again with renderers sharing one state. */
+static void test_two_renderers(GLuint prog_a, GLuint prog_b)
+{
+    struct glsprite_render_state state;
+    struct glsprite_renderer rend_a, rend_b;
+    struct glsprite_draw_buffer buf_a, buf_b;
+    struct glsprite_sheet sheet_a, sheet_b;
+
+    glsprite_render_state_init(&state);
+    CHECK(glsprite_renderer_init(&rend_a, &state, prog_a, 640, 480) == 0);
+    CHECK(glsprite_renderer_init(&rend_b, &state, prog_b, 640, 480) == 0);
+    glsprite_sheet_init(&sheet_a, 10, 64, 64);
+    glsprite_sheet_init(&sheet_b, 20, 32, 16);
+    glsprite_draw_buffer_init(&buf_a, &sheet_a);
+    glsprite_draw_buffer_init(&buf_b, &sheet_b);
+    push_sprites(&buf_a, 3);
+    push_sprites(&buf_b, 5);
+
+    glsprite_render_draw_buffer(&rend_a, &buf_a);
+    check_draw(&rend_a, &buf_a);
+    glsprite_render_draw_buffer(&rend_b, &buf_b);
+    check_draw(&rend_b, &buf_b);
+
+    glshim_reset_calls();
+    glsprite_render_draw_buffer(&rend_a, &buf_a);
+    check_draw(&rend_a, &buf_a);
+    CHECK(glshim_calls[GLSHIM_USE_PROGRAM] == (prog_a != prog_b));
+    CHECK(glshim_calls[GLSHIM_BIND_VERTEX_ARRAY] == 1);
+    CHECK(glshim_calls[GLSHIM_BIND_TEXTURE] == 1);
+    /* A shared program keeps its use_regions value. */
+    CHECK(glshim_calls[GLSHIM_UNIFORM] == 1 + (prog_a != prog_b));
+    CHECK(glshim_calls[GLSHIM_DRAW] == 1);
+
+    glsprite_draw_buffer_destroy(&buf_b);
+    glsprite_draw_buffer_destroy(&buf_a);
+    glsprite_renderer_destroy(&rend_b);
+    glsprite_renderer_destroy(&rend_a);
+}
+
+/* Region attributes are only uploaded for buffers holding region sprites. */
+static void test_regions(void)
+{
+    static const struct glsprite_slice slice = { 2.0f, 2.0f, 2.0f, 2.0f };
+    struct glsprite_render_state state;
+    struct glsprite_renderer rend;
+    struct glsprite_draw_buffer plain, regions;
+    struct glsprite_slice *slices;
+    struct glsprite_sheet sheet;
+
+    glsprite_render_state_init(&state);
+    CHECK(glsprite_renderer_init(&rend, &state, 5, 640, 480) == 0);
+    glsprite_sheet_init(&sheet, 10, 64, 64);
+    glsprite_draw_buffer_init(&plain, &sheet);
+    glsprite_draw_buffer_init(&regions, &sheet);
+    push_sprites(&plain, 3);
+    push_sprites(&regions, 3);
+    CHECK(plain.sprite_slices == NULL);
+    CHECK(regions.sprite_slices == NULL);
+
+    glsprite_draw_buffer_push_nine_slice(&regions, vec2f_init(0.0f, 0.0f),
+                                         vec2f_init(8.0f, 8.0f), &slice,
+                                         vec2f_init(0.0f, 0.0f),
+                                         vec2f_init(32.0f, 16.0f),
+                                         vec2f_init(0.0f, 0.0f), 0.0f);
+    push_sprites(&regions, 1);
+    CHECK(regions.num_sprites == 5);
+    CHECK(regions.sheet_dimensions[0].x == 8.0f);
+    CHECK(regions.sprite_repeats[0].x == 1.0f);
+    CHECK(regions.sprite_slices[0].left == 0.0f);
+    CHECK(regions.sheet_dimensions[3].x == 8.0f);
+    CHECK(regions.sprite_dimensions[3].x == 32.0f);
+    CHECK(regions.sprite_slices[3].left == 2.0f);
+    CHECK(regions.sheet_dimensions[4].x == 8.0f);
+    CHECK(regions.sprite_slices[4].left == 0.0f);
+
+    /* Adding the arrays again must keep the existing ones. */
+    slices = regions.sprite_slices;
+    glsprite_draw_buffer_add_regions(&regions);
+    CHECK(regions.sprite_slices == slices);
+    CHECK(regions.sprite_slices[3].left == 2.0f);
+
+    glshim_reset_calls();
+    glsprite_render_draw_buffer(&rend, &regions);
+    check_draw(&rend, &regions);
+    CHECK(glshim_calls[GLSHIM_BUFFER_DATA] ==
+          NUM_PLAIN_UPLOADS + NUM_REGION_UPLOADS);
+    CHECK(glshim_calls[GLSHIM_ENABLE_ARRAY] == NUM_REGION_UPLOADS);
+
+    glshim_reset_calls();
+    glsprite_render_draw_buffer(&rend, &plain);
+    check_draw(&rend, &plain);
+    CHECK(glshim_calls[GLSHIM_BUFFER_DATA] == NUM_PLAIN_UPLOADS);
+    CHECK(glshim_calls[GLSHIM_ENABLE_ARRAY] == NUM_REGION_UPLOADS);
+    CHECK(glshim_calls[GLSHIM_UNIFORM] == 1);
+
+    glshim_reset_calls();
+    glsprite_render_draw_buffer(&rend, &plain);
+    CHECK(glshim_calls[GLSHIM_ENABLE_ARRAY] == 0);
+    CHECK(glshim_calls[GLSHIM_UNIFORM] == 0);
+
+    glsprite_draw_buffer_destroy(&regions);
+    glsprite_draw_buffer_destroy(&plain);
+    glsprite_renderer_destroy(&rend);
+}
+
+/* A new sheet may get the name of a deleted one and must still be bound. */
+static void test_sheet_destroy(void)
+{
+    struct glsprite_render_state state;
+    struct glsprite_renderer rend;
+    struct glsprite_draw_buffer buf;
+    struct glsprite_sheet sheet;
+
+    glsprite_render_state_init(&state);
+    CHECK(glsprite_renderer_init(&rend, &state, 6, 640, 480) == 0);
+    glsprite_sheet_init(&sheet, 30, 64, 64);
+    glsprite_draw_buffer_init(&buf, &sheet);
+    push_sprites(&buf, 2);
+    glsprite_render_draw_buffer(&rend, &buf);
+
+    glsprite_sheet_destroy(&sheet, &state);
+    CHECK(sheet.texture_id == 0);
+    CHECK(state.texture_id == 0);
+
+    glsprite_sheet_init(&sheet, 30, 64, 64);
+    glshim_reset_calls();
+    glsprite_render_draw_buffer(&rend, &buf);
+    CHECK(glshim_calls[GLSHIM_BIND_TEXTURE] == 1);
+    check_draw(&rend, &buf);
+
+    glsprite_draw_buffer_destroy(&buf);
+    glsprite_renderer_destroy(&rend);
+}
+
+int main(void)
+{
+    test_same_buffer_twice();
+    test_two_renderers(2, 3);
+    test_two_renderers(4, 4);
+    test_regions();
+    test_sheet_destroy();
+
+    if (num_failures) {
+        fprintf(stderr, "%d checks failed\n", num_failures);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
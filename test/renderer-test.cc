@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2019 Aapo Vienamo
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Checks that glsprite::renderer skips exactly the redundant GL calls and
+ * stays in sync with C renderers sharing its glsprite_render_state.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#define GL_GLEXT_PROTOTYPES
+#if defined(__APPLE__)
+#include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+#else
+#include <GL/gl.h>
+#include <GL/glext.h>
+#endif
+
+#include "glsprite.hh"
+#include "glshim.h"
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, \
+                         __LINE__, #cond);                              \
+            ++num_failures;                                             \
+        }                                                               \
+    } while (0)
+
+/* Per-instance arrays uploaded by the C renderer for plain sprites. */
+#define NUM_C_UPLOADS 5
+
+using renderer_type = glsprite::renderer<glsprite::attr::position,
+                                         glsprite::attr::size,
+                                         glsprite::attr::sheet_offset,
+                                         glsprite::attr::tint>;
+using buffer_type = renderer_type::buffer_type;
+
+static constexpr unsigned num_attrs = 4;
+
+static int num_failures;
+
+static void push_sprites(buffer_type &buf, int n)
+{
+    for (int i = 0; i < n; ++i)
+        buf.push(vm::vec2f{float(i), float(i)}, vm::vec2f{8.0f, 8.0f},
+                 vm::vec2f{0.0f, 0.0f}, glsprite::attr::rgba8{255, 0, 0, 255});
+}
+
+static void push_sprites(glsprite_draw_buffer *buf, int n)
+{
+    for (int i = 0; i < n; ++i)
+        glsprite_draw_buffer_push(buf, vm::vec2f{0.0f, 0.0f},
+                                  vm::vec2f{float(i), float(i)},
+                                  vm::vec2f{8.0f, 8.0f},
+                                  vm::vec2f{0.0f, 0.0f}, 0.0f);
+}
+
+static void check_draw(GLuint prog_id, const buffer_type &buf)
+{
+    CHECK(glshim_last_draw.prog_id == prog_id);
+    CHECK(glshim_last_draw.vao_id != 0);
+    CHECK(glshim_last_draw.texture_id == buf.sheet().texture_id);
+    CHECK(glshim_last_draw.sheet_width == buf.sheet().width);
+    CHECK(glshim_last_draw.sheet_height == buf.sheet().height);
+    CHECK(glshim_last_draw.num_instances == GLsizei(buf.size()));
+    CHECK(glshim_last_draw.use_regions == 0);
+    CHECK(glshim_last_draw.num_enabled_arrays == 1 + num_attrs);
+}
+
+static void check_draw(const glsprite_renderer &rend,
+                       const glsprite_draw_buffer &buf)
+{
+    CHECK(glshim_last_draw.prog_id == rend.prog_id);
+    CHECK(glshim_last_draw.vao_id == rend.vao_id);
+    CHECK(glshim_last_draw.texture_id == buf.sheet->texture_id);
+    CHECK(glshim_last_draw.sheet_width == buf.sheet->width);
+    CHECK(glshim_last_draw.sheet_height == buf.sheet->height);
+    CHECK(glshim_last_draw.num_instances == GLsizei(buf.num_sprites));
+    CHECK(glshim_last_draw.num_enabled_arrays == 1 + NUM_C_UPLOADS);
+}
+
+static void test_same_buffer_twice()
+{
+    glsprite_render_state state;
+    glsprite_sheet sheet;
+
+    glsprite_render_state_init(&state);
+    glsprite_sheet_init(&sheet, 10, 64, 64);
+    buffer_type buf(sheet);
+    push_sprites(buf, 3);
+
+    auto rend = renderer_type::create(state, 1, 640, 480);
+    CHECK(rend);
+    if (!rend)
+        return;
+
+    glshim_reset_calls();
+    rend->render(buf);
+    check_draw(1, buf);
+    CHECK(glshim_calls[GLSHIM_USE_PROGRAM] == 0);
+    CHECK(glshim_calls[GLSHIM_BIND_VERTEX_ARRAY] == 0);
+    CHECK(glshim_calls[GLSHIM_BIND_TEXTURE] == 1);
+    /* sheet_size, use_regions and time. */
+    CHECK(glshim_calls[GLSHIM_UNIFORM] == 3);
+    CHECK(glshim_calls[GLSHIM_BUFFER_DATA] == num_attrs);
+
+    /* Only the instance data has to be bound and uploaded again. */
+    glshim_reset_calls();
+    rend->render(buf);
+    check_draw(1, buf);
+    CHECK(glshim_calls[GLSHIM_BIND_BUFFER] == num_attrs);
+    CHECK(glshim_calls[GLSHIM_BUFFER_DATA] == num_attrs);
+    CHECK(glshim_calls[GLSHIM_DRAW] == 1);
+    CHECK(glshim_total_calls() == 2 * num_attrs + 1);
+}
+
+/*
+ * Interleaves a C and a C++ renderer, with either their own programs or a
+ * shared one.
+ */
+static void test_mixed(GLuint prog_c, GLuint prog_cpp)
+{
+    glsprite_render_state state;
+    glsprite_renderer rend_c;
+    glsprite_draw_buffer buf_c;
+    glsprite_sheet sheet_c, sheet_cpp;
+    int i;
+
+    glsprite_render_state_init(&state);
+    glsprite_sheet_init(&sheet_c, 20, 64, 64);
+    glsprite_sheet_init(&sheet_cpp, 21, 128, 32);
+    CHECK(glsprite_renderer_init(&rend_c, &state, prog_c, 640, 480) == 0);
+    glsprite_draw_buffer_init(&buf_c, &sheet_c);
+    push_sprites(&buf_c, 2);
+
+    buffer_type buf_cpp(sheet_cpp);
+    push_sprites(buf_cpp, 5);
+    auto rend_cpp = renderer_type::create(state, prog_cpp, 640, 480);
+    CHECK(rend_cpp);
+    if (!rend_cpp)
+        return;
+
+    for (i = 0; i < 2; ++i) {
+        glsprite_render_draw_buffer(&rend_c, &buf_c);
+        check_draw(rend_c, buf_c);
+
+        glshim_reset_calls();
+        rend_cpp->render(buf_cpp);
+        check_draw(prog_cpp, buf_cpp);
+        CHECK(glshim_calls[GLSHIM_USE_PROGRAM] == (prog_c != prog_cpp));
+        CHECK(glshim_calls[GLSHIM_BIND_VERTEX_ARRAY] == 1);
+        CHECK(glshim_calls[GLSHIM_BIND_TEXTURE] == 1);
+        CHECK(glshim_calls[GLSHIM_BUFFER_DATA] == num_attrs);
+        /*
+         * The C renderer changes sheet_size and use_regions on its program,
+         * time is only set by the C++ one.
+         */
+        if (i > 0)
+            CHECK(glshim_calls[GLSHIM_UNIFORM] == 1 + (prog_c != prog_cpp));
+
+        glshim_reset_calls();
+        glsprite_render_draw_buffer(&rend_c, &buf_c);
+        check_draw(rend_c, buf_c);
+        CHECK(glshim_calls[GLSHIM_USE_PROGRAM] == (prog_c != prog_cpp));
+        CHECK(glshim_calls[GLSHIM_BIND_VERTEX_ARRAY] == 1);
+        CHECK(glshim_calls[GLSHIM_BIND_TEXTURE] == 1);
+        CHECK(glshim_calls[GLSHIM_UNIFORM] == 1 + (prog_c != prog_cpp));
+        CHECK(glshim_calls[GLSHIM_BUFFER_DATA] == NUM_C_UPLOADS);
+    }
+
+    glsprite_draw_buffer_destroy(&buf_c);
+    glsprite_renderer_destroy(&rend_c);
+}
+
+static void test_time()
+{
+    glsprite_render_state state;
+    glsprite_sheet sheet;
+
+    glsprite_render_state_init(&state);
+    glsprite_sheet_init(&sheet, 10, 64, 64);
+    buffer_type buf(sheet);
+    push_sprites(buf, 1);
+
+    auto rend = renderer_type::create(state, 5, 640, 480);
+    CHECK(rend);
+    if (!rend)
+        return;
+
+    rend->set_time(0.5f);
+    rend->render(buf);
+    CHECK(glshim_last_draw.time == 0.5f);
+
+    glshim_reset_calls();
+    rend->render(buf);
+    CHECK(glshim_calls[GLSHIM_UNIFORM] == 0);
+
+    rend->set_time(0.75f);
+    glshim_reset_calls();
+    rend->render(buf);
+    CHECK(glshim_calls[GLSHIM_UNIFORM] == 1);
+    CHECK(glshim_last_draw.time == 0.75f);
+}
+
+/* A destroyed renderer's vertex array and buffers must not stay shadowed. */
+static void test_destroy()
+{
+    glsprite_render_state state;
+    glsprite_renderer rend_c;
+    glsprite_draw_buffer buf_c;
+    glsprite_sheet sheet;
+
+    glsprite_render_state_init(&state);
+    glsprite_sheet_init(&sheet, 10, 64, 64);
+    CHECK(glsprite_renderer_init(&rend_c, &state, 6, 640, 480) == 0);
+    glsprite_draw_buffer_init(&buf_c, &sheet);
+    push_sprites(&buf_c, 2);
+
+    {
+        buffer_type buf(sheet);
+        push_sprites(buf, 2);
+
+        auto rend = renderer_type::create(state, 6, 640, 480);
+        CHECK(rend);
+        if (rend)
+            rend->render(buf);
+    }
+
+    CHECK(state.vao_id == 0);
+    CHECK(state.array_buffer_id == 0);
+
+    glshim_reset_calls();
+    glsprite_render_draw_buffer(&rend_c, &buf_c);
+    check_draw(rend_c, buf_c);
+    CHECK(glshim_calls[GLSHIM_BIND_VERTEX_ARRAY] == 1);
+
+    glsprite_draw_buffer_destroy(&buf_c);
+    glsprite_renderer_destroy(&rend_c);
+}
+
+int main()
+{
+    test_same_buffer_twice();
+    test_mixed(2, 3);
+    test_mixed(4, 4);
+    test_time();
+    test_destroy();
+
+    if (num_failures) {
+        std::fprintf(stderr, "%d checks failed\n", num_failures);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
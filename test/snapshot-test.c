@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2019 Aapo Vienamo
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Checks that snapshots read back exactly what was written, that a buffer
+ * pointing into a snapshot copies the arrays before modifying them and that
+ * malformed snapshot files are rejected.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "glsprite.h"
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,     \
+                    __LINE__, #cond);                                   \
+            ++num_failures;                                             \
+        }                                                               \
+    } while (0)
+
+#define SNAPSHOT_PATH "snapshot-test.bin"
+#define CORRUPT_PATH "snapshot-test-corrupt.bin"
+#define SHEET_NAME "sheet.png"
+#define NUM_SPRITES 37
+
+/* Byte offsets of the header fields, see glsprite_snapshot.c. */
+#define HDR_VERSION 8
+#define HDR_ARR_OFFSETS 32
+#define NUM_ARRS 8
+#define ARR_SPRITE_POSITIONS 1
+#define ARR_SPRITE_SLICES 6
+
+static int num_failures;
+
+static void push_sprites(struct glsprite_draw_buffer *buf, int regions)
+{
+    static const struct glsprite_slice slice = { 1.0f, 2.0f, 3.0f, 4.0f };
+    int i;
+
+    for (i = 0; i < NUM_SPRITES; ++i) {
+        struct vec2f pos = vec2f_init(i, -i);
+
+        if (regions && i % 3 == 0)
+            glsprite_draw_buffer_push_nine_slice(buf, vec2f_init(i, 1.0f),
+                                                 vec2f_init(16.0f, 16.0f),
+                                                 &slice, pos,
+                                                 vec2f_init(40.0f, 20.0f),
+                                                 vec2f_init(1.0f, 1.0f),
+                                                 0.5f * i);
+        else if (regions && i % 3 == 1)
+            glsprite_draw_buffer_push_tiled(buf, vec2f_init(i, 2.0f),
+                                            vec2f_init(8.0f, 8.0f),
+                                            vec2i_init(3, 2), pos,
+                                            vec2f_init(2.0f, 2.0f), 0.25f * i);
+        else
+            glsprite_draw_buffer_push(buf, vec2f_init(i, 3.0f), pos,
+                                      vec2f_init(8.0f, 4.0f),
+                                      vec2f_init(4.0f, 2.0f), 0.125f * i);
+    }
+}
+
+#define ARRAY_EQ(a, b, n) (!memcmp((a), (b), (n) * sizeof((a)[0])))
+
+static int buffers_eq(const struct glsprite_draw_buffer *a,
+                      const struct glsprite_draw_buffer *b)
+{
+    size_t n = a->num_sprites;
+
+    if (n != b->num_sprites ||
+        !ARRAY_EQ(a->sheet_offsets, b->sheet_offsets, n) ||
+        !ARRAY_EQ(a->sprite_positions, b->sprite_positions, n) ||
+        !ARRAY_EQ(a->sprite_dimensions, b->sprite_dimensions, n) ||
+        !ARRAY_EQ(a->sprite_origins, b->sprite_origins, n) ||
+        !ARRAY_EQ(a->sprite_angles, b->sprite_angles, n) ||
+        !a->sprite_slices != !b->sprite_slices)
+        return 0;
+
+    if (!a->sprite_slices)
+        return 1;
+
+    return ARRAY_EQ(a->sheet_dimensions, b->sheet_dimensions, n) &&
+           ARRAY_EQ(a->sprite_slices, b->sprite_slices, n) &&
+           ARRAY_EQ(a->sprite_repeats, b->sprite_repeats, n);
+}
+
+static void test_round_trip(int regions)
+{
+    struct glsprite_draw_buffer buf, mapped;
+    struct glsprite_snapshot snap;
+    struct glsprite_sheet sheet;
+
+    glsprite_sheet_init(&sheet, 0, 128, 64);
+    glsprite_draw_buffer_init(&buf, &sheet);
+    push_sprites(&buf, regions);
+    CHECK(!buf.sprite_slices == !regions);
+    CHECK(glsprite_snapshot_write(SNAPSHOT_PATH, &buf, SHEET_NAME) == 0);
+
+    CHECK(glsprite_snapshot_open(&snap, SNAPSHOT_PATH) == 0);
+    CHECK(!strcmp(snap.sheet_name, SHEET_NAME));
+    CHECK(snap.sheet_width == 128);
+    CHECK(snap.sheet_height == 64);
+    CHECK(glsprite_draw_buffer_init_snapshot(&mapped, &sheet, &snap) == 0);
+    CHECK(mapped.borrowed);
+    CHECK(buffers_eq(&buf, &mapped));
+
+    glsprite_draw_buffer_destroy(&mapped);
+    glsprite_snapshot_close(&snap);
+    glsprite_draw_buffer_destroy(&buf);
+    remove(SNAPSHOT_PATH);
+}
+
+static int in_map(const struct glsprite_snapshot *snap, const void *p)
+{
+    const char *map = snap->map;
+
+    return (const char *)p >= map && (const char *)p < map + snap->map_len;
+}
+
+/* Pushing into a mapped buffer must not write into the snapshot. */
+static void test_push_copies(void)
+{
+    struct glsprite_draw_buffer buf, mapped;
+    struct glsprite_snapshot snap;
+    struct glsprite_sheet sheet;
+    struct vec2f pos;
+
+    glsprite_sheet_init(&sheet, 0, 128, 64);
+    glsprite_draw_buffer_init(&buf, &sheet);
+    push_sprites(&buf, 0);
+    CHECK(glsprite_snapshot_write(SNAPSHOT_PATH, &buf, SHEET_NAME) == 0);
+    CHECK(glsprite_snapshot_open(&snap, SNAPSHOT_PATH) == 0);
+    CHECK(glsprite_draw_buffer_init_snapshot(&mapped, &sheet, &snap) == 0);
+
+    pos = vec2f_init(100.0f, 200.0f);
+    glsprite_draw_buffer_push(&mapped, pos, pos, pos, pos, 1.0f);
+    CHECK(mapped.borrowed == 0);
+    CHECK(mapped.num_sprites == NUM_SPRITES + 1);
+    CHECK(!in_map(&snap, mapped.sheet_offsets));
+    CHECK(!in_map(&snap, mapped.sprite_positions));
+    CHECK(!in_map(&snap, mapped.sprite_dimensions));
+    CHECK(!in_map(&snap, mapped.sprite_origins));
+    CHECK(!in_map(&snap, mapped.sprite_angles));
+    CHECK(mapped.sprite_positions[NUM_SPRITES].x == 100.0f);
+    mapped.num_sprites = NUM_SPRITES;
+    CHECK(buffers_eq(&buf, &mapped));
+    CHECK(snap.num_sprites == NUM_SPRITES);
+    CHECK(ARRAY_EQ(snap.sprite_positions, buf.sprite_positions, NUM_SPRITES));
+
+    glsprite_draw_buffer_destroy(&mapped);
+    glsprite_snapshot_close(&snap);
+    glsprite_draw_buffer_destroy(&buf);
+    remove(SNAPSHOT_PATH);
+}
+
+static size_t read_file(const char *path, unsigned char **data)
+{
+    FILE *f = fopen(path, "rb");
+    long len;
+
+    *data = NULL;
+    if (!f)
+        return 0;
+
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    *data = malloc(len);
+    if (!*data || fread(*data, 1, len, f) != (size_t)len)
+        len = 0;
+    fclose(f);
+
+    return len;
+}
+
+static int open_corrupt(const unsigned char *data, size_t len)
+{
+    struct glsprite_snapshot snap;
+    FILE *f = fopen(CORRUPT_PATH, "wb");
+
+    if (!f)
+        return -1;
+    fwrite(data, 1, len, f);
+    fclose(f);
+
+    if (glsprite_snapshot_open(&snap, CORRUPT_PATH))
+        return -1;
+
+    glsprite_snapshot_close(&snap);
+
+    return 0;
+}
+
+static uint64_t get_arr_offset(const unsigned char *data, int i)
+{
+    uint64_t off;
+
+    memcpy(&off, data + HDR_ARR_OFFSETS + i * sizeof(off), sizeof(off));
+
+    return off;
+}
+
+static void set_arr_offset(unsigned char *data, int i, uint64_t off)
+{
+    memcpy(data + HDR_ARR_OFFSETS + i * sizeof(off), &off, sizeof(off));
+}
+
+static void test_corrupt(void)
+{
+    struct glsprite_draw_buffer buf;
+    struct glsprite_sheet sheet;
+    unsigned char *orig, *data;
+    uint64_t off;
+    size_t len;
+
+    glsprite_sheet_init(&sheet, 0, 128, 64);
+    glsprite_draw_buffer_init(&buf, &sheet);
+    push_sprites(&buf, 1);
+    CHECK(glsprite_snapshot_write(SNAPSHOT_PATH, &buf, SHEET_NAME) == 0);
+    glsprite_draw_buffer_destroy(&buf);
+
+    len = read_file(SNAPSHOT_PATH, &orig);
+    CHECK(len > HDR_ARR_OFFSETS + NUM_ARRS * sizeof(off));
+    data = malloc(len);
+    if (!orig || !data || len <= HDR_ARR_OFFSETS + NUM_ARRS * sizeof(off)) {
+        free(orig);
+        free(data);
+        return;
+    }
+
+    /* The unmodified file has to open for the other cases to mean anything. */
+    CHECK(open_corrupt(orig, len) == 0);
+
+    memcpy(data, orig, len);
+    data[0] ^= 1;
+    CHECK(open_corrupt(data, len) == -1);
+
+    memcpy(data, orig, len);
+    data[HDR_VERSION] += 1;
+    CHECK(open_corrupt(data, len) == -1);
+
+    memcpy(data, orig, len);
+    off = get_arr_offset(data, ARR_SPRITE_POSITIONS);
+    set_arr_offset(data, ARR_SPRITE_POSITIONS, off + sizeof(float));
+    CHECK(open_corrupt(data, len) == -1);
+
+    memcpy(data, orig, len);
+    off = get_arr_offset(data, 0);
+    set_arr_offset(data, ARR_SPRITE_POSITIONS, off);
+    CHECK(open_corrupt(data, len) == -1);
+
+    /* Offsets pointing into the header or past the end of the file. */
+    memcpy(data, orig, len);
+    set_arr_offset(data, ARR_SPRITE_POSITIONS, 0);
+    CHECK(open_corrupt(data, len) == -1);
+
+    memcpy(data, orig, len);
+    set_arr_offset(data, ARR_SPRITE_POSITIONS, (uint64_t)1 << 62);
+    CHECK(open_corrupt(data, len) == -1);
+
+    /* The region arrays must be all present or all absent. */
+    memcpy(data, orig, len);
+    set_arr_offset(data, ARR_SPRITE_SLICES, 0);
+    CHECK(open_corrupt(data, len) == -1);
+
+    CHECK(open_corrupt(orig, len - 1) == -1);
+    CHECK(open_corrupt(orig, HDR_ARR_OFFSETS) == -1);
+
+    free(data);
+    free(orig);
+    remove(CORRUPT_PATH);
+    remove(SNAPSHOT_PATH);
+}
+
+int main(void)
+{
+    test_round_trip(0);
+    test_round_trip(1);
+    test_push_copies();
+    test_corrupt();
+
+    if (num_failures) {
+        fprintf(stderr, "%d checks failed\n", num_failures);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
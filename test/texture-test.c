@@ -0,0 +1,490 @@
+/*
+ * Copyright (c) 2019 Aapo Vienamo
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Checks the CPU side of the sheet texture pipeline: padding, mipmapping,
+ * block compression and the texture file format.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "glsprite.h"
+#include "glshim.h"
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,     \
+                    __LINE__, #cond);                                   \
+            ++num_failures;                                             \
+        }                                                               \
+    } while (0)
+
+#define TEXTURE_PATH "texture-test.tex"
+#define TEXTURE_COPY_PATH "texture-test-copy.tex"
+
+/*
+ * A 3x2 sheet of 9x10 sprites in 11x12 cells with a 1 texel margin. The
+ * sprite sizes are picked so that cells only aligned to the block size would
+ * not be aligned to the texels of the last level.
+ */
+#define SHEET_COLS 3
+#define SHEET_ROWS 2
+#define SPRITE_W 9
+#define SPRITE_H 10
+#define CELL_W 11
+#define CELL_H 12
+#define SHEET_MARGIN 1
+#define SHEET_W (SHEET_MARGIN + SHEET_COLS * CELL_W)
+#define SHEET_H (SHEET_MARGIN + SHEET_ROWS * CELL_H)
+#define PAD_LEVELS 4
+
+/* Largest per channel error allowed from the block encoders. */
+#define MAX_BLOCK_ERROR 6
+
+static int num_failures;
+
+static unsigned char *texel(const struct glsprite_texture_level *level,
+                            unsigned x, unsigned y)
+{
+    return level->data + ((size_t)y * level->width + x) * 4;
+}
+
+/*
+ * The red channel is the same for the whole sprite and differs between
+ * sprites, green and blue vary within the sprite. Everything between the
+ * sprites is opaque white, which must never end up in the padded sheet.
+ */
+static unsigned char *make_sheet(void)
+{
+    unsigned char *rgba = malloc(SHEET_W * SHEET_H * 4);
+    unsigned x, y;
+
+    if (!rgba)
+        return NULL;
+
+    memset(rgba, 255, SHEET_W * SHEET_H * 4);
+
+    for (y = 0; y < SHEET_ROWS * CELL_H; ++y) {
+        for (x = 0; x < SHEET_COLS * CELL_W; ++x) {
+            unsigned char *p = rgba + ((SHEET_MARGIN + y) * SHEET_W +
+                                       SHEET_MARGIN + x) * 4;
+            unsigned cell = y / CELL_H * SHEET_COLS + x / CELL_W;
+
+            if (x % CELL_W >= SPRITE_W || y % CELL_H >= SPRITE_H)
+                continue;
+
+            p[0] = 20 + 40 * cell;
+            p[1] = 25 * (x % CELL_W);
+            p[2] = 25 * (y % CELL_H);
+            p[3] = 128;
+        }
+    }
+
+    return rgba;
+}
+
+static unsigned clampu(int v, unsigned max)
+{
+    if (v < 0)
+        return 0;
+    if ((unsigned)v > max)
+        return max;
+    return v;
+}
+
+static void test_pad(void)
+{
+    const struct glsprite_texture_level *base, *last;
+    struct glsprite_grid grid, padded;
+    struct glsprite_texture tex;
+    unsigned char *rgba = make_sheet();
+    unsigned stride_x, stride_y, gutter;
+    unsigned x, y;
+
+    glsprite_grid_init(&grid, SPRITE_W, SPRITE_H, SHEET_MARGIN);
+    grid.grid_dims = vec2f_init(CELL_W, CELL_H);
+
+    CHECK(glsprite_texture_pad(&tex, &padded, rgba, SHEET_W, SHEET_H, &grid,
+                               0) == -1);
+    CHECK(glsprite_texture_pad(&tex, &padded, rgba, SHEET_W, SHEET_H, &grid,
+                               PAD_LEVELS) == 0);
+    free(rgba);
+
+    gutter = 1u << (PAD_LEVELS - 1);
+    stride_x = padded.grid_dims.x;
+    stride_y = padded.grid_dims.y;
+    CHECK(padded.margin == gutter);
+    CHECK(padded.sprite_dims.x == SPRITE_W);
+    CHECK(padded.sprite_dims.y == SPRITE_H);
+    CHECK(stride_x >= SPRITE_W + 2 * gutter);
+    CHECK(stride_y >= SPRITE_H + 2 * gutter);
+    /* A compression block of the last level must not span two cells. */
+    CHECK(stride_x % (4u << (PAD_LEVELS - 1)) == 0);
+    CHECK(stride_y % (4u << (PAD_LEVELS - 1)) == 0);
+
+    base = &tex.levels[0];
+    CHECK(tex.num_levels == 1);
+    CHECK(base->width == SHEET_COLS * stride_x);
+    CHECK(base->height == SHEET_ROWS * stride_y);
+
+    /* The sprite is copied as is and its edges are extruded into the gutter. */
+    for (y = 0; y < base->height; ++y) {
+        for (x = 0; x < base->width; ++x) {
+            unsigned cell = y / stride_y * SHEET_COLS + x / stride_x;
+            unsigned sx = clampu((int)(x % stride_x) - (int)gutter,
+                                 SPRITE_W - 1);
+            unsigned sy = clampu((int)(y % stride_y) - (int)gutter,
+                                 SPRITE_H - 1);
+            const unsigned char *p = texel(base, x, y);
+
+            if (p[0] != 20 + 40 * cell || p[1] != 25 * sx ||
+                p[2] != 25 * sy || p[3] != 128) {
+                CHECK(!"padded texel mismatch");
+                y = base->height;
+                break;
+            }
+        }
+    }
+
+    CHECK(glsprite_texture_gen_mipmaps(&tex, PAD_LEVELS) == 0);
+    CHECK(tex.num_levels == PAD_LEVELS);
+
+    /* Every texel of the last level only mixes texels of its own sprite. */
+    last = &tex.levels[PAD_LEVELS - 1];
+    CHECK(last->width == base->width >> (PAD_LEVELS - 1));
+    CHECK(last->height == base->height >> (PAD_LEVELS - 1));
+    for (y = 0; y < last->height; ++y) {
+        for (x = 0; x < last->width; ++x) {
+            unsigned cell = (y << (PAD_LEVELS - 1)) / stride_y * SHEET_COLS +
+                            (x << (PAD_LEVELS - 1)) / stride_x;
+            const unsigned char *p = texel(last, x, y);
+
+            if (p[0] != 20 + 40 * cell || p[3] != 128) {
+                CHECK(!"mip texel bleeds between sprites");
+                y = last->height;
+                break;
+            }
+        }
+    }
+
+    glsprite_texture_destroy(&tex);
+}
+
+static int make_texture(struct glsprite_texture *tex, unsigned w, unsigned h,
+                        const unsigned char *rgba)
+{
+    tex->format = GLSPRITE_TEXTURE_RGBA8;
+    tex->num_levels = 1;
+    tex->levels[0].width = w;
+    tex->levels[0].height = h;
+    tex->levels[0].size = (size_t)w * h * 4;
+    tex->levels[0].data = malloc(tex->levels[0].size);
+    if (!tex->levels[0].data)
+        return -1;
+
+    memcpy(tex->levels[0].data, rgba, tex->levels[0].size);
+
+    return 0;
+}
+
+static void test_gen_mipmaps(void)
+{
+    static const unsigned char rgba[2][4][4] = {
+        { { 0, 10, 255, 1 }, { 4, 20, 255, 2 },
+          { 100, 0, 0, 0 }, { 200, 0, 0, 0 } },
+        { { 8, 30, 255, 3 }, { 12, 40, 254, 4 },
+          { 50, 0, 0, 0 }, { 150, 0, 0, 255 } },
+    };
+    struct glsprite_texture tex;
+    const unsigned char *p;
+
+    CHECK(make_texture(&tex, 4, 2, &rgba[0][0][0]) == 0);
+
+    /* Stops at 1x1 even if more levels are asked for. */
+    CHECK(glsprite_texture_gen_mipmaps(&tex, 8) == 0);
+    CHECK(tex.num_levels == 3);
+    CHECK(tex.levels[1].width == 2 && tex.levels[1].height == 1);
+    CHECK(tex.levels[2].width == 1 && tex.levels[2].height == 1);
+    CHECK(tex.levels[1].size == 2 * 4);
+
+    /* Each texel is the rounded average of the 2x2 texels above it. */
+    p = texel(&tex.levels[1], 0, 0);
+    CHECK(p[0] == 6 && p[1] == 25 && p[2] == 255 && p[3] == 3);
+    p = texel(&tex.levels[1], 1, 0);
+    CHECK(p[0] == 125 && p[1] == 0 && p[2] == 0 && p[3] == 64);
+    p = texel(&tex.levels[2], 0, 0);
+    CHECK(p[0] == 66 && p[1] == 13 && p[2] == 128 && p[3] == 34);
+
+    /* Already generated levels are kept. */
+    CHECK(glsprite_texture_gen_mipmaps(&tex, 2) == 0);
+    CHECK(tex.num_levels == 3);
+
+    glsprite_texture_destroy(&tex);
+
+    /* An empty texture has no level to derive the others from. */
+    memset(&tex, 0, sizeof(tex));
+    CHECK(glsprite_texture_gen_mipmaps(&tex, 4) == -1);
+    CHECK(tex.num_levels == 0);
+}
+
+static void decode_565(unsigned v, int *c)
+{
+    unsigned r = (v >> 11) & 0x1f;
+    unsigned g = (v >> 5) & 0x3f;
+    unsigned b = v & 0x1f;
+
+    c[0] = r << 3 | r >> 2;
+    c[1] = g << 2 | g >> 4;
+    c[2] = b << 3 | b >> 2;
+}
+
+/* Decodes the color part of a block like the hardware does. */
+static void decode_color_block(const unsigned char *in, int four_color,
+                               unsigned char out[16][4])
+{
+    unsigned c0 = in[0] | in[1] << 8;
+    unsigned c1 = in[2] | in[3] << 8;
+    uint32_t indices = in[4] | in[5] << 8 | in[6] << 16 |
+                       (uint32_t)in[7] << 24;
+    int palette[4][3];
+    int i, c;
+
+    decode_565(c0, palette[0]);
+    decode_565(c1, palette[1]);
+    for (c = 0; c < 3; ++c) {
+        if (four_color || c0 > c1) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        } else {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+
+    for (i = 0; i < 16; ++i)
+        for (c = 0; c < 3; ++c)
+            out[i][c] = palette[(indices >> (2 * i)) & 3][c];
+}
+
+static void decode_alpha_block(const unsigned char *in,
+                               unsigned char out[16][4])
+{
+    int a0 = in[0], a1 = in[1];
+    uint64_t indices = 0;
+    int palette[8];
+    int i, j;
+
+    for (i = 0; i < 6; ++i)
+        indices |= (uint64_t)in[2 + i] << (8 * i);
+
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0 > a1) {
+        for (j = 1; j < 7; ++j)
+            palette[j + 1] = ((7 - j) * a0 + j * a1) / 7;
+    } else {
+        for (j = 1; j < 5; ++j)
+            palette[j + 1] = ((5 - j) * a0 + j * a1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    for (i = 0; i < 16; ++i)
+        out[i][3] = palette[(indices >> (3 * i)) & 7];
+}
+
+/* Returns the largest per channel error of the compressed level. */
+static int block_error(const struct glsprite_texture_level *level,
+                       const unsigned char *rgba,
+                       enum glsprite_texture_format format)
+{
+    size_t block_size = format == GLSPRITE_TEXTURE_BC3 ? 16 : 8;
+    const unsigned char *in = level->data;
+    unsigned char block[16][4];
+    int max_err = 0;
+    unsigned bx, by, x, y, c;
+
+    for (by = 0; by < level->height; by += 4) {
+        for (bx = 0; bx < level->width; bx += 4) {
+            if (format == GLSPRITE_TEXTURE_BC3) {
+                decode_alpha_block(in, block);
+                decode_color_block(in + 8, 1, block);
+            } else {
+                decode_color_block(in, 0, block);
+            }
+            in += block_size;
+
+            for (y = 0; y < 4 && by + y < level->height; ++y) {
+                for (x = 0; x < 4 && bx + x < level->width; ++x) {
+                    const unsigned char *src = rgba +
+                        ((by + y) * level->width + bx + x) * 4;
+                    unsigned num_channels =
+                        format == GLSPRITE_TEXTURE_BC3 ? 4 : 3;
+
+                    for (c = 0; c < num_channels; ++c) {
+                        int err = abs(block[y * 4 + x][c] - src[c]);
+
+                        if (err > max_err)
+                            max_err = err;
+                    }
+                }
+            }
+        }
+    }
+
+    return max_err;
+}
+
+/* Smooth gradients with flat blocks in between, like typical sprite art. */
+static unsigned char *make_gradient(unsigned w, unsigned h)
+{
+    unsigned char *rgba = malloc(w * h * 4);
+    unsigned x, y;
+
+    if (!rgba)
+        return NULL;
+
+    for (y = 0; y < h; ++y) {
+        for (x = 0; x < w; ++x) {
+            unsigned char *p = rgba + (y * w + x) * 4;
+
+            p[0] = 2 * x;
+            p[1] = 3 * y;
+            p[2] = (x / 4 + y / 4) % 2 ? 200 : 60;
+            p[3] = 255 - 2 * (x + y);
+        }
+    }
+
+    return rgba;
+}
+
+static void test_compress(enum glsprite_texture_format format)
+{
+    /* Not a multiple of the block size to cover the partial edge blocks. */
+    const unsigned w = 30, h = 18;
+    unsigned char *rgba = make_gradient(w, h);
+    struct glsprite_texture tex;
+    size_t block_size = format == GLSPRITE_TEXTURE_BC3 ? 16 : 8;
+
+    CHECK(make_texture(&tex, w, h, rgba) == 0);
+    CHECK(glsprite_texture_compress(&tex, format) == 0);
+    CHECK(tex.format == format);
+    CHECK(tex.levels[0].size == 8 * 5 * block_size);
+    CHECK(block_error(&tex.levels[0], rgba, format) <= MAX_BLOCK_ERROR);
+
+    /* Compressed textures can be neither compressed again nor mipmapped. */
+    CHECK(glsprite_texture_compress(&tex, GLSPRITE_TEXTURE_BC1) == -1);
+    CHECK(glsprite_texture_gen_mipmaps(&tex, 2) == -1);
+
+    glsprite_texture_destroy(&tex);
+    free(rgba);
+}
+
+static size_t read_file(const char *path, unsigned char **data)
+{
+    FILE *f = fopen(path, "rb");
+    long len;
+
+    *data = NULL;
+    if (!f)
+        return 0;
+
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    *data = malloc(len);
+    if (!*data || fread(*data, 1, len, f) != (size_t)len)
+        len = 0;
+    fclose(f);
+
+    return len;
+}
+
+static void test_write_load(void)
+{
+    struct glsprite_grid grid, loaded_grid;
+    struct glsprite_texture tex, loaded, truncated;
+    struct glsprite_sheet sheet;
+    unsigned char *rgba = make_gradient(32, 16);
+    unsigned char *file, *copy;
+    size_t file_len, copy_len;
+    size_t vram_bytes = 0;
+    unsigned i;
+
+    glsprite_grid_init(&grid, 21, 21, 8);
+    grid.grid_dims = vec2f_init(64, 32);
+
+    CHECK(make_texture(&tex, 32, 16, rgba) == 0);
+    CHECK(glsprite_texture_gen_mipmaps(&tex, 3) == 0);
+    CHECK(glsprite_texture_compress(&tex, GLSPRITE_TEXTURE_BC3) == 0);
+    CHECK(glsprite_texture_write(TEXTURE_PATH, &tex, &grid) == 0);
+
+    CHECK(glsprite_texture_load(&loaded, &loaded_grid, TEXTURE_PATH) == 0);
+    CHECK(loaded.format == tex.format);
+    CHECK(loaded.num_levels == tex.num_levels);
+    for (i = 0; i < tex.num_levels && i < loaded.num_levels; ++i) {
+        CHECK(loaded.levels[i].width == tex.levels[i].width);
+        CHECK(loaded.levels[i].height == tex.levels[i].height);
+        CHECK(loaded.levels[i].size == tex.levels[i].size);
+        CHECK(!memcmp(loaded.levels[i].data, tex.levels[i].data,
+                      tex.levels[i].size));
+        vram_bytes += tex.levels[i].size;
+    }
+    CHECK(!memcmp(&loaded_grid, &grid, sizeof(grid)));
+
+    /* Writing the loaded texture again gives the same file. */
+    CHECK(glsprite_texture_write(TEXTURE_COPY_PATH, &loaded,
+                                 &loaded_grid) == 0);
+    file_len = read_file(TEXTURE_PATH, &file);
+    copy_len = read_file(TEXTURE_COPY_PATH, &copy);
+    CHECK(file_len > 0);
+    CHECK(file_len == copy_len);
+    CHECK(file && copy && !memcmp(file, copy, file_len));
+
+    /* A truncated file must not load. */
+    if (file && file_len > 0) {
+        FILE *f = fopen(TEXTURE_COPY_PATH, "wb");
+
+        if (f) {
+            fwrite(file, 1, file_len - 1, f);
+            fclose(f);
+        }
+        CHECK(glsprite_texture_load(&truncated, &loaded_grid,
+                                    TEXTURE_COPY_PATH) == -1);
+    }
+
+    CHECK(glsprite_sheet_init_texture(&sheet, &loaded) == 0);
+    CHECK(sheet.width == 32 && sheet.height == 16);
+    CHECK(sheet.vram_bytes == vram_bytes);
+    glsprite_sheet_destroy(&sheet, NULL);
+
+    glsprite_texture_destroy(&loaded);
+    glsprite_texture_destroy(&tex);
+    free(copy);
+    free(file);
+    free(rgba);
+    remove(TEXTURE_COPY_PATH);
+    remove(TEXTURE_PATH);
+}
+
+int main(void)
+{
+    test_pad();
+    test_gen_mipmaps();
+    test_compress(GLSPRITE_TEXTURE_BC1);
+    test_compress(GLSPRITE_TEXTURE_BC3);
+    test_write_load();
+
+    if (num_failures) {
+        fprintf(stderr, "%d checks failed\n", num_failures);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}